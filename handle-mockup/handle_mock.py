@@ -1,6 +1,7 @@
 #!/usr/bin/env python
-from flask import Flask, request
+from flask import Flask, request, Response
 from werkzeug import ImmutableMultiDict
+from email.utils import formatdate, parsedate_tz, mktime_tz
 from flask_restful import Resource, Api
 from pprint import pprint
 import argparse
@@ -8,6 +9,9 @@ import os
 import re
 import sys
 import atexit
+import hashlib
+import json
+import time
 
 
 HANDLE_SUCCESS = 1
@@ -18,6 +22,7 @@ HANDLE_OP_NOT_SUPPORTED = 5
 HANDLE_RECURSION_COUNT_TOO_HIGH = 6
 HANDLE_NOT_FOUND = 100
 HTTP_200_OK = 200
+HTTP_304_NOT_MODIFIED = 304
 HTTP_400_BAD_REQUEST = 400
 HTTP_404_NOT_FOUND = 404
 
@@ -26,20 +31,57 @@ class HandleData(object):
     def __init__(self, verbose=False):
         self.verbose = verbose
         self.handles = {}
+        self.modified = {}
 
     def register_prefix(self, prefix):
         if prefix not in self.handles:
             self.handles[prefix] = {}
 
+    def touch(self, prefix, suffix):
+        self.modified[(prefix, suffix)] = time.time()
+
+    def validators(self, prefix, suffix):
+        """
+        ETag and Last-Modified header of a handle record.
+        """
+        if prefix not in self.handles or suffix not in self.handles[prefix]:
+            return {}
+        values = json.dumps(self.handles[prefix][suffix], sort_keys=True)
+        etag = hashlib.sha1(values.encode('utf-8')).hexdigest()
+        modified = self.modified.get((prefix, suffix), time.time())
+        return {"ETag": '"%s"' % etag,
+                "Last-Modified": formatdate(modified, usegmt=True)}
+
+    def not_modified(self, prefix, suffix, headers):
+        validators = self.validators(prefix, suffix)
+        if not validators:
+            return False
+        if_none_match = headers.get('If-None-Match')
+        if if_none_match is not None:
+            return if_none_match == validators['ETag']
+        if_modified_since = headers.get('If-Modified-Since')
+        if if_modified_since is not None:
+            since = parsedate_tz(if_modified_since)
+            modified = int(self.modified.get((prefix, suffix), time.time()))
+            return since is not None and modified <= mktime_tz(since)
+        return False
+
     def get_handle(self, prefix, suffix, args=ImmutableMultiDict()):
         if self.verbose:
             print("HandleData.get_handle(%s/%s)" % (prefix, suffix))
             pprint(args)
         if prefix in self.handles:
             if suffix in self.handles[prefix]:
+                values = self.handles[prefix][suffix]
+                indices = [str(i) for i in args.getlist('index')]
+                types = args.getlist('type')
+                if indices or types:
+                    values = [obj for obj in values
+                              if str(obj.get('index', '')) in indices or
+                              obj.get('type') in types]
                 return ({"responseCode": HANDLE_SUCCESS,
                          "handle": "%s/%s" % (prefix, suffix),
-                         "values": self.handles[prefix][suffix]},
+                         "values": values},
                         HTTP_200_OK)
             else:
                 if self.verbose:
@@ -81,6 +123,7 @@ class HandleData(object):
                         print("added %s/%s" % (prefix, suffix))
                         pprint(json_data)
                 self.handles[prefix][suffix] = json_data['values']
+                self.touch(prefix, suffix)
                 return {"responseCode": HANDLE_SUCCESS,
                         "handle": "%s/%s" % (prefix, suffix)}
         else:
@@ -97,6 +140,7 @@ class HandleData(object):
             if suffix in self.handles[prefix]:
                 if not args.has_key('index'):
                     del self.handles[prefix][suffix]
+                    self.modified.pop((prefix, suffix), None)
                     return ({"responseCode": HANDLE_SUCCESS,
                              "handle": "%s/%s" % (prefix, suffix)},
                             HTTP_200_OK)
@@ -106,6 +150,7 @@ class HandleData(object):
                            for obj in self.handles[prefix][suffix]
                            if str(obj.get('index', '')) not in indices]
                     self.handles[prefix][suffix] = tmp
+                    self.touch(prefix, suffix)
                     return ({"responseCode": HANDLE_SUCCESS,
                              "handle": "%s/%s" % (prefix, suffix)},
                             HTTP_200_OK)
@@ -162,11 +207,17 @@ class HandleData(object):
         return re.compile(".*".join([re.escape(tok)
                                      for tok in input_str.split('*')]))
 
-    def reverse_lookup(self, filters, prefix):
+    def reverse_lookup(self, filters, prefix, limit=None, page=0,
+                       retrieverecords=False):
         filters = {k: self.glob2regex(f) for k, f in  filters.items()}
         ret =  ["%s/%s" % (prefix, suffix)
-                for suffix, obj in self.handles[prefix].items()
+                for suffix, obj in sorted(self.handles[prefix].items())
                 if self.match_filter(filters, prefix, suffix, obj)]
+        if limit is not None:
+            ret = ret[page * limit:(page + 1) * limit]
+        if retrieverecords:
+            ret = {handle: self.handles[prefix][handle.split('/', 1)[1]]
+                   for handle in ret}
         print("reverse lookup result:")
         pprint(ret)
         return ret
@@ -179,7 +230,11 @@ class HandleMock(Resource):
         super(HandleMock, self).__init__(**kwarg)
 
     def get(self, prefix, suffix):
-        return self.handle_data.get_handle(prefix, suffix, request.args)
+        validators = self.handle_data.validators(prefix, suffix)
+        if self.handle_data.not_modified(prefix, suffix, request.headers):
+            return Response(status=HTTP_304_NOT_MODIFIED, headers=validators)
+        data, code = self.handle_data.get_handle(prefix, suffix, request.args)
+        return data, code, validators
 
     def put(self, prefix, suffix):
         json_data = request.get_json(force=True)
@@ -200,13 +255,17 @@ class ReverseLookupMock(Resource):
     def get(self, prefix):
         if sys.version_info[0] == 3:
             filters = {str(k): str(values[-1])
-                       for k, values in request.args.to_dict().items()
-                       if k != 'limit' and k != 'page'}
+                       for k, values in request.args.to_dict(flat=False).items()
+                       if k not in ('limit', 'page', 'retrieverecords')}
         else:
             filters = {str(k): str(values[-1])
                        for k, values in request.args.iterlists()
-                       if k != 'limit' and k != 'page'}
-        return self.handle_data.reverse_lookup(filters, prefix)
+                       if k not in ('limit', 'page', 'retrieverecords')}
+        limit = request.args.get('limit', None, type=int)
+        page = request.args.get('page', 0, type=int)
+        retrieverecords = request.args.get('retrieverecords', 'false') == 'true'
+        return self.handle_data.reverse_lookup(filters, prefix, limit, page,
+                                               retrieverecords)
 
 
 def create_pid_file(pid_file):
@@ -0,0 +1,293 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <surfsara/util.h>
+
+namespace surfsara
+{
+  namespace util
+  {
+    /**
+     * Bloom filter of strings, optionally backed by a memory mapped file.
+     *
+     * The filter has no false negatives: mayContain is true for every
+     * value that has been added. Bits are set atomically, so that threads
+     * and processes that map the same file can add values concurrently.
+     *
+     * A new filter knows nothing about existing values, so mayContain is
+     * true for every value until setComplete marks that all values have
+     * been added (bloom_build). Negative answers of a complete filter are
+     * only correct as long as every process that adds values (creates
+     * handles) updates the same file.
+     */
+    class BloomFilter
+    {
+    public:
+      /**
+       * @param capacity expected number of values
+       * @param bitsPerValue size of the filter, 10 bits give a false positive
+       *        rate of about 1%, 16 bits of about 0.05%
+       * @param file backing file, created if missing. The size and number of
+       *        hashes of an existing file take precedence over capacity and
+       *        bitsPerValue. Without file the filter is kept in memory only.
+       */
+      BloomFilter(std::size_t capacity,
+                  std::size_t bitsPerValue = 16,
+                  const std::string & file = "");
+      ~BloomFilter();
+      BloomFilter(const BloomFilter &) = delete;
+      BloomFilter & operator=(const BloomFilter &) = delete;
+
+      inline void add(const std::string & value);
+
+      /**
+       * False only if the filter is complete and value has not been added.
+       */
+      inline bool mayContain(const std::string & value) const;
+
+      /**
+       * Mark that all existing values have been added.
+       */
+      inline void setComplete();
+      inline bool isComplete() const;
+
+      /**
+       * Write modified pages of a file backed filter to disk.
+       */
+      inline void sync();
+
+      inline std::uint64_t getBits() const;
+      inline std::uint64_t getHashes() const;
+
+      /**
+       * Number of add calls, including duplicates
+       */
+      inline std::uint64_t getCount() const;
+
+    private:
+      struct Header
+      {
+        char magic[8];
+        std::uint64_t bits;
+        std::uint64_t hashes;
+        std::uint64_t count;
+        std::uint64_t flags;
+      };
+
+      inline void map(std::size_t bytes, int fd);
+
+      std::string file;
+      std::size_t mappedSize;
+      void * mapped;
+      Header * header;
+      unsigned char * data;
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace surfsara
+{
+  namespace util
+  {
+    namespace details
+    {
+      static const char bloomMagic[8] = {'S', 'B', 'L', 'O', 'O', 'M', '0', '2'};
+      static const std::uint64_t bloomComplete = 1;
+    }
+
+    inline BloomFilter::BloomFilter(std::size_t capacity,
+                                    std::size_t bitsPerValue,
+                                    const std::string & _file)
+      : file(_file), mappedSize(0), mapped(nullptr), header(nullptr), data(nullptr)
+    {
+      std::uint64_t bits = std::uint64_t(capacity ? capacity : 1) * (bitsPerValue ? bitsPerValue : 1);
+      bits = (bits + 63) & ~std::uint64_t(63);
+      std::uint64_t hashes = std::uint64_t(std::lround(double(bitsPerValue) * std::log(2.0)));
+      if(hashes == 0)
+      {
+        hashes = 1;
+      }
+      std::size_t bytes = sizeof(Header) + bits / 8;
+      if(file.empty())
+      {
+        map(bytes, -1);
+        std::memcpy(header->magic, details::bloomMagic, sizeof(header->magic));
+        header->bits = bits;
+        header->hashes = hashes;
+        header->count = 0;
+        header->flags = 0;
+        return;
+      }
+      int fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+      if(fd < 0)
+      {
+        throw std::runtime_error(std::string("failed to open bloom filter ") + file +
+                                 ": " + std::strerror(errno));
+      }
+      // the first process initializes the file
+      flock(fd, LOCK_EX);
+      struct stat st;
+      bool ok = (fstat(fd, &st) == 0);
+      if(ok && st.st_size == 0)
+      {
+        Header init;
+        std::memcpy(init.magic, details::bloomMagic, sizeof(init.magic));
+        init.bits = bits;
+        init.hashes = hashes;
+        init.count = 0;
+        init.flags = 0;
+        ok = (ftruncate(fd, bytes) == 0 &&
+              pwrite(fd, &init, sizeof(init), 0) == ssize_t(sizeof(init)));
+      }
+      else if(ok)
+      {
+        Header existing;
+        ok = (std::size_t(st.st_size) >= sizeof(Header) &&
+              pread(fd, &existing, sizeof(existing), 0) == ssize_t(sizeof(existing)) &&
+              std::memcmp(existing.magic, details::bloomMagic, sizeof(existing.magic)) == 0 &&
+              existing.bits > 0 && existing.bits % 64 == 0 && existing.hashes > 0 &&
+              std::uint64_t(st.st_size) == sizeof(Header) + existing.bits / 8);
+        bytes = st.st_size;
+      }
+      flock(fd, LOCK_UN);
+      if(!ok)
+      {
+        ::close(fd);
+        throw std::runtime_error(std::string("invalid bloom filter file ") + file);
+      }
+      try
+      {
+        map(bytes, fd);
+      }
+      catch(...)
+      {
+        ::close(fd);
+        throw;
+      }
+      // the mapping stays valid after closing
+      ::close(fd);
+    }
+
+    inline BloomFilter::~BloomFilter()
+    {
+      if(mapped)
+      {
+        munmap(mapped, mappedSize);
+      }
+    }
+
+    inline void BloomFilter::map(std::size_t bytes, int fd)
+    {
+      void * ptr = (fd < 0 ?
+                    mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0) :
+                    mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+      if(ptr == MAP_FAILED)
+      {
+        throw std::runtime_error(std::string("failed to map bloom filter ") + file +
+                                 ": " + std::strerror(errno));
+      }
+      mapped = ptr;
+      mappedSize = bytes;
+      header = static_cast<Header*>(ptr);
+      data = static_cast<unsigned char*>(ptr) + sizeof(Header);
+    }
+
+    inline void BloomFilter::add(const std::string & value)
+    {
+      // double hashing: bit i = h1 + i * h2
+      std::uint64_t h1 = fnv1a(value);
+      std::uint64_t h2 = fnv1a(value, 0x84222325cbf29ce4ULL) | 1;
+      for(std::uint64_t i = 0; i < header->hashes; i++)
+      {
+        std::uint64_t bit = (h1 + i * h2) % header->bits;
+        __atomic_fetch_or(&data[bit >> 3], static_cast<unsigned char>(1u << (bit & 7)), __ATOMIC_RELAXED);
+      }
+      __atomic_fetch_add(&header->count, 1, __ATOMIC_RELAXED);
+    }
+
+    inline bool BloomFilter::mayContain(const std::string & value) const
+    {
+      if(!isComplete())
+      {
+        return true;
+      }
+      std::uint64_t h1 = fnv1a(value);
+      std::uint64_t h2 = fnv1a(value, 0x84222325cbf29ce4ULL) | 1;
+      for(std::uint64_t i = 0; i < header->hashes; i++)
+      {
+        std::uint64_t bit = (h1 + i * h2) % header->bits;
+        if(!(__atomic_load_n(&data[bit >> 3], __ATOMIC_RELAXED) & (1u << (bit & 7))))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    inline void BloomFilter::setComplete()
+    {
+      __atomic_fetch_or(&header->flags, details::bloomComplete, __ATOMIC_RELEASE);
+    }
+
+    inline bool BloomFilter::isComplete() const
+    {
+      return (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & details::bloomComplete) != 0;
+    }
+
+    inline void BloomFilter::sync()
+    {
+      if(!file.empty())
+      {
+        msync(mapped, mappedSize, MS_SYNC);
+      }
+    }
+
+    inline std::uint64_t BloomFilter::getBits() const
+    {
+      return header->bits;
+    }
+
+    inline std::uint64_t BloomFilter::getHashes() const
+    {
+      return header->hashes;
+    }
+
+    inline std::uint64_t BloomFilter::getCount() const
+    {
+      return __atomic_load_n(&header->count, __ATOMIC_RELAXED);
+    }
+  }
+}
@@ -20,10 +20,14 @@ limitations under the License.
 #include "curl_util.h"
 #include <curl/curl.h>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <exception>
 #include <sstream>
 #include <initializer_list>
 #include <iostream>
+#include <mutex>
+#include <functional>
 
 namespace surfsara
 {
@@ -36,10 +40,62 @@ namespace surfsara
       CURLcode curlCode;
       bool success;
       std::string body;
+      // response headers, names in lower case
+      std::map<std::string, std::string> headers;
       Result() : httpCode(0), curlCode(CURLE_OK), success(false) {}
+
+      inline std::string getHeader(const std::string & name) const;
     };
     ::std::ostream & operator<<(::std::ostream & ost, const Result & res);
-   
+
+    /**
+     * Initialize libcurl once per process.
+     * curl_global_init is not thread safe, call it (or create a GlobalInit)
+     * in main before threads are started.
+     */
+    inline void globalInit();
+
+    /**
+     * Scoped process wide initialization of libcurl.
+     * Create exactly one instance in main, idle handles are released and
+     * curl_global_cleanup is called when it goes out of scope.
+     */
+    class GlobalInit
+    {
+    public:
+      inline GlobalInit();
+      inline ~GlobalInit();
+      GlobalInit(const GlobalInit&) = delete;
+      GlobalInit & operator=(const GlobalInit&) = delete;
+    };
+
+    /**
+     * Idle easy handles shared by all Curl instances of the process.
+     * A handle keeps its connection and TLS session cache when it is
+     * returned, so that subsequent requests reuse open connections.
+     * Acquired handles have CURLOPT_NOSIGNAL set.
+     */
+    class HandlePool
+    {
+    public:
+      static inline HandlePool & instance();
+      inline ~HandlePool();
+      inline CURL * acquire();
+      inline void release(CURL * curl);
+      inline void clear();
+      inline std::size_t idleSize();
+
+    private:
+      HandlePool(std::size_t _maxIdle) : maxIdle(_maxIdle) {}
+      std::mutex mutex;
+      std::vector<CURL*> idle;
+      std::size_t maxIdle;
+    };
+
+    /**
+     * A single request. Instances are not shared between threads, the
+     * easy handle is taken from the HandlePool and returned in the destructor.
+     */
     class Curl
     {
     public:
@@ -47,9 +103,27 @@ namespace surfsara
       Curl(const InitializerList & options);
       Curl(const std::vector<std::shared_ptr<BasicCurlOpt>> & options);
       ~Curl();
+      Curl(const Curl&) = delete;
+      Curl & operator=(const Curl&) = delete;
       inline Result request();
+
+      /**
+       * Pass the body of a successful response to sink as it arrives,
+       * instead of collecting it in Result::body. The body of an error
+       * response is collected as usual.
+       * If sink returns false the transfer is aborted with CURLE_WRITE_ERROR.
+       */
+      inline Result request(std::function<bool(const char * data, std::size_t size)> sink);
     private:
+      struct StreamTarget
+      {
+        CURL * curl;
+        std::function<bool(const char * data, std::size_t size)> sink;
+        std::string * body;
+      };
       static size_t write(char *ptr, size_t size, size_t nmemb, void *userdata);
+      static size_t writeStream(char *ptr, size_t size, size_t nmemb, void *userdata);
+      static size_t header(char *ptr, size_t size, size_t nmemb, void *userdata);
       CURL *curl;
       std::vector<std::shared_ptr<BasicCurlOpt>> optSetter;
       std::string buffer;
@@ -74,10 +148,119 @@ namespace surfsara
       return ost;
     }
 
+    inline std::string Result::getHeader(const std::string & name) const
+    {
+      auto itr = headers.find(name);
+      if(itr == headers.end())
+      {
+        return std::string();
+      }
+      else
+      {
+        return itr->second;
+      }
+    }
+
+    inline void globalInit()
+    {
+      static std::once_flag flag;
+      std::call_once(flag, []() {
+          if(curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
+          {
+            throw std::runtime_error("could not initialize libcurl");
+          }
+        });
+    }
+
+    inline GlobalInit::GlobalInit()
+    {
+      globalInit();
+    }
+
+    inline GlobalInit::~GlobalInit()
+    {
+      HandlePool::instance().clear();
+      curl_global_cleanup();
+    }
+
+    inline HandlePool & HandlePool::instance()
+    {
+      static HandlePool pool(16);
+      return pool;
+    }
+
+    inline HandlePool::~HandlePool()
+    {
+      clear();
+    }
+
+    inline CURL * HandlePool::acquire()
+    {
+      CURL * curl = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!idle.empty())
+        {
+          curl = idle.back();
+          idle.pop_back();
+        }
+      }
+      if(!curl)
+      {
+        globalInit();
+        curl = curl_easy_init();
+      }
+      if(curl)
+      {
+        // signals are process wide: timeouts must not use SIGALRM when
+        // handles are used by several threads (reset by curl_easy_reset)
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+      }
+      return curl;
+    }
+
+    inline void HandlePool::release(CURL * curl)
+    {
+      if(!curl)
+      {
+        return;
+      }
+      // drop all options but keep the connection cache
+      curl_easy_reset(curl);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(idle.size() < maxIdle)
+        {
+          idle.push_back(curl);
+          return;
+        }
+      }
+      curl_easy_cleanup(curl);
+    }
+
+    inline void HandlePool::clear()
+    {
+      std::vector<CURL*> tmp;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        tmp.swap(idle);
+      }
+      for(auto curl : tmp)
+      {
+        curl_easy_cleanup(curl);
+      }
+    }
+
+    inline std::size_t HandlePool::idleSize()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return idle.size();
+    }
+
     inline Curl::Curl(const InitializerList & options) :
       optSetter(options.begin(), options.end())
     {
-      curl = curl_easy_init();
+      curl = HandlePool::instance().acquire();
       if(!curl)
       {
         throw std::runtime_error("could not initiate curl");
@@ -94,8 +277,7 @@ namespace surfsara
     inline Curl::Curl(const std::vector<std::shared_ptr<BasicCurlOpt>> & options) :
       optSetter(options)
     {
-      curl = curl_easy_init();
-      curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+      curl = HandlePool::instance().acquire();
       if(!curl)
       {
         throw std::runtime_error("could not initiate curl");
@@ -111,7 +293,7 @@ namespace surfsara
 
     inline Curl::~Curl()
     {
-      curl_easy_cleanup(curl);
+      HandlePool::instance().release(curl);
     }
 
     inline Result Curl::request()
@@ -119,6 +301,8 @@ namespace surfsara
       Result res;
       curl_easy_setopt(curl, CURLOPT_WRITEDATA, &res.body);
       curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &Curl::write);
+      curl_easy_setopt(curl, CURLOPT_HEADERDATA, &res.headers);
+      curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &Curl::header);
       res.curlCode = curl_easy_perform(curl);
       res.httpCode = 0;
       res.success = false;
@@ -130,11 +314,77 @@ namespace surfsara
       return res;
     }
 
+    inline Result Curl::request(std::function<bool(const char * data, std::size_t size)> sink)
+    {
+      Result res;
+      StreamTarget target{curl, sink, &res.body};
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &target);
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &Curl::writeStream);
+      curl_easy_setopt(curl, CURLOPT_HEADERDATA, &res.headers);
+      curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &Curl::header);
+      res.curlCode = curl_easy_perform(curl);
+      res.httpCode = 0;
+      res.success = false;
+      curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &res.httpCode);
+      if (httpCodeIsSuccess(res.httpCode) && res.curlCode == CURLE_OK)
+      {
+        res.success = true;
+      }
+      return res;
+    }
+
+    size_t Curl::writeStream(char *ptr, size_t size, size_t nmemb, void *userdata)
+    {
+      auto target = static_cast<StreamTarget*>(userdata);
+      long httpCode = 0;
+      // the status is known once the headers have been received
+      curl_easy_getinfo(target->curl, CURLINFO_RESPONSE_CODE, &httpCode);
+      if(!httpCodeIsSuccess(httpCode))
+      {
+        target->body->append(ptr, ptr + size * nmemb);
+        return size * nmemb;
+      }
+      if(!target->sink(ptr, size * nmemb))
+      {
+        return 0;
+      }
+      return size * nmemb;
+    }
+
     size_t Curl::write(char *ptr, size_t size, size_t nmemb, void *userdata)
     {
       auto result = static_cast<std::string*>(userdata);
       result->append(ptr, ptr + nmemb);
       return nmemb;
     }
+
+    size_t Curl::header(char *ptr, size_t size, size_t nmemb, void *userdata)
+    {
+      auto headers = static_cast<std::map<std::string, std::string>*>(userdata);
+      std::string line(ptr, ptr + size * nmemb);
+      if(line.compare(0, 5, "HTTP/") == 0)
+      {
+        // status line of a new response (redirect, 100 Continue)
+        headers->clear();
+        return size * nmemb;
+      }
+      std::size_t pos = line.find(':');
+      if(pos != std::string::npos)
+      {
+        std::string name(line.begin(), line.begin() + pos);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::size_t begin = line.find_first_not_of(" \t", pos + 1);
+        std::size_t end = line.find_last_not_of(" \t\r\n");
+        if(begin != std::string::npos && end != std::string::npos && end >= begin)
+        {
+          (*headers)[name] = line.substr(begin, end - begin + 1);
+        }
+        else
+        {
+          (*headers)[name] = std::string();
+        }
+      }
+      return size * nmemb;
+    }
   }  // curl
 } // surfsara
@@ -187,20 +187,40 @@ namespace surfsara
       class HeaderList : public BasicCurlOpt
       {
       public:
-        HeaderList(const std::initializer_list<std::string> & _headers) : headers(_headers){}
-        HeaderList(const std::vector<std::string> & _headers) : headers(_headers){}
+        HeaderList(const std::initializer_list<std::string> & _headers) : headers(_headers), chunk(NULL)
+        {
+          init();
+        }
+
+        HeaderList(const std::vector<std::string> & _headers) : headers(_headers), chunk(NULL)
+        {
+          init();
+        }
+
+        HeaderList(const HeaderList&) = delete;
+        HeaderList & operator=(const HeaderList&) = delete;
+
+        ~HeaderList()
+        {
+          curl_slist_free_all(chunk);
+        }
 
         virtual CURLcode set(CURL *curl) const override
         {
-          struct curl_slist *chunk = NULL;
+          // the list must outlive the request, it is owned by this option
+          return curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+        }
+
+      private:
+        void init()
+        {
           for(auto line : headers) {
             chunk = curl_slist_append(chunk, line.c_str());
           }
-          return curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
         }
 
-      private:
         std::vector<std::string> headers;
+        struct curl_slist *chunk;
       };
 
       ///////////////// SSL /////////////////
@@ -19,6 +19,9 @@ limitations under the License.
 #include "i_handle_client.h"
 #include <surfsara/handle_result.h>
 #include <surfsara/handle_util.h>
+#include <surfsara/handle_suffix.h>
+#include <surfsara/json_scanner.h>
+#include <surfsara/lru_cache.h>
 #include <surfsara/curl.h>
 #include <surfsara/json_format.h>
 #include <surfsara/json_parser.h>
@@ -28,12 +31,26 @@ namespace surfsara
 {
   namespace handle
   {
+    /**
+     * In-process cache of handle records, keyed by handle.
+     */
+    using RecordCache = surfsara::util::LruCache<std::string, Result>;
+
+    /**
+     * Client for the handle REST API.
+     * All methods can be called from concurrent threads: the configuration
+     * is immutable after construction, the record cache and the suffix
+     * generator synchronize internally and each request runs on its own
+     * easy handle from the curl::HandlePool.
+     */
     class HandleClient : public I_HandleClient
     {
     public:
       HandleClient(const std::string & url,
                    std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> options = {},
-                   bool _verbose = false);
+                   bool _verbose = false,
+                   std::shared_ptr<RecordCache> _cache = nullptr,
+                   std::shared_ptr<I_SuffixGenerator> _suffixGenerator = nullptr);
 
       Result create(const std::string & prefix, const surfsara::ast::Node & node) override
       {
@@ -45,6 +62,26 @@ namespace surfsara
         return getImpl(handle);
       }
 
+      Result get(const std::string & handle, const std::vector<int> & indices) override
+      {
+        std::vector<std::pair<std::string, std::string>> params;
+        for(auto idx : indices)
+        {
+          params.push_back(std::make_pair("index", std::to_string(idx)));
+        }
+        return getPartialImpl(handle, params);
+      }
+
+      Result get(const std::string & handle, const std::vector<std::string> & types) override
+      {
+        std::vector<std::pair<std::string, std::string>> params;
+        for(auto & type : types)
+        {
+          params.push_back(std::make_pair("type", type));
+        }
+        return getPartialImpl(handle, params);
+      }
+
       Result update(const std::string & handle, const surfsara::ast::Node & node) override
       {
         return updateImpl(handle, node);
@@ -64,18 +101,42 @@ namespace surfsara
       inline std::string generateHandle(const std::string & prefix);
       inline const std::string& getUrl() const;
       inline std::string getUrlWithHandle(const std::string & handle) const;
+      inline surfsara::util::CacheStatistics getCacheStatistics() const;
+
+      /**
+       * Size of a cache entry in bytes, used to bound the record cache.
+       */
+      inline static std::size_t recordSize(const std::string & handle, const Result & res);
 
     private:
       inline Result createImpl(const std::string & prefix, const surfsara::ast::Node & node);
       inline Result getImpl(const std::string & handle);
+      inline Result getPartialImpl(const std::string & handle,
+                                   const std::vector<std::pair<std::string, std::string>> & params);
       inline Result updateImpl(const std::string & handle, const surfsara::ast::Node & node);
       inline Result removeIndicesImpl(const std::string & handle, const std::vector<int> & indices);
       inline Result removeImpl(const std::string & handle);
       inline static void extractResponse(Result & res, const surfsara::ast::Node & json);
-      inline Result curlRequest(const std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> & optionsCopy);
+      inline static bool extractResponse(Result & res, const std::string & body);
+      inline static std::vector<std::string> conditionalHeaders(const Result & cached);
+
+      /**
+       * Validators of the response no longer describe a record that has
+       * been modified by write-through, it must not be revalidated by them.
+       */
+      inline static void dropValidators(Result & cached);
+      /**
+       * Perform the request. The decoded response is kept in Result::data
+       * if keepTree is set or the scanner rejects the body, otherwise
+       * it is decoded on first access.
+       */
+      inline Result curlRequest(const std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> & optionsCopy,
+                                bool keepTree = false);
       std::string url;
       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> options;
       bool verbose;
+      std::shared_ptr<RecordCache> cache;
+      std::shared_ptr<I_SuffixGenerator> suffixGenerator;
     };
   }
 }
@@ -85,9 +146,6 @@ namespace surfsara
 // implementation
 //
 ///////////////////////////////////////////////////////////////////////////////////////
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
 #include <sstream>
 
 namespace surfsara
@@ -96,9 +154,16 @@ namespace surfsara
   {
     inline HandleClient::HandleClient(const std::string & _url,
                                       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> _options,
-                                      bool _verbose)
-      : url(_url), options(_options), verbose(_verbose)
+                                      bool _verbose,
+                                      std::shared_ptr<RecordCache> _cache,
+                                      std::shared_ptr<I_SuffixGenerator> _suffixGenerator)
+      : url(_url), options(_options), verbose(_verbose), cache(_cache),
+        suffixGenerator(_suffixGenerator)
     {
+      if(!suffixGenerator)
+      {
+        suffixGenerator = std::make_shared<UuidV4SuffixGenerator>();
+      }
     }
 
     inline Result HandleClient::createImpl(const std::string & prefix, const Node & node)
@@ -113,6 +178,7 @@ namespace surfsara
 
       if(verbose)
       {
+        std::lock_guard<std::mutex> lock(surfsara::util::outputMutex());
         std::cout << "request data:" << std::endl
                   << surfsara::ast::formatJson(node, true) << std::endl;
       }
@@ -122,9 +188,48 @@ namespace surfsara
 
     inline Result HandleClient::getImpl(const std::string & handle)
     {
+      Result cached;
+      bool expired = false;
+      if(cache && cache->get(handle, cached, expired) && !expired)
+      {
+        return cached;
+      }
       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> optionsCopy(options);
       optionsCopy.push_back(surfsara::curl::Url(getUrlWithHandle(handle), {}));
-      return curlRequest(optionsCopy);
+      std::vector<std::string> validators;
+      if(expired)
+      {
+        validators = conditionalHeaders(cached);
+        if(!validators.empty())
+        {
+          optionsCopy.push_back(surfsara::curl::Header(validators));
+        }
+      }
+      Result res = curlRequest(optionsCopy, true);
+      if(!validators.empty() && res.curlResult.httpCode == 304)
+      {
+        // not modified: serve the cached record without transferring it again
+        cache->refresh(handle);
+        return cached;
+      }
+      if(cache && res.success)
+      {
+        cache->put(handle, res);
+      }
+      return res;
+    }
+
+    inline Result HandleClient::getPartialImpl(const std::string & handle,
+                                               const std::vector<std::pair<std::string, std::string>> & params)
+    {
+      if(params.empty())
+      {
+        return getImpl(handle);
+      }
+      // partial records are not cached
+      std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> optionsCopy(options);
+      optionsCopy.push_back(surfsara::curl::Url(getUrlWithHandle(handle), params));
+      return curlRequest(optionsCopy, true);
     }
 
     inline Result HandleClient::updateImpl(const std::string & handle,
@@ -141,12 +246,34 @@ namespace surfsara
       optionsCopy.push_back(surfsara::curl::Data(surfsara::ast::formatJson(node)));
       if(verbose)
       {
+        std::lock_guard<std::mutex> lock(surfsara::util::outputMutex());
         std::cout << "request data:" << std::endl
                   << surfsara::ast::formatJson(node, true) << std::endl;
       }
-      return curlRequest(optionsCopy);
+      Result res = curlRequest(optionsCopy);
+      if(cache)
+      {
+        try
+        {
+          // write-through: the server keeps the indices not listed in the request
+          if(!res.success ||
+             !cache->modify(handle, [&node](Result & cached) {
+                 mergeValues(cached.data.get(), node);
+                 cached.curlResult.body = surfsara::ast::formatJson(cached.data);
+                 dropValidators(cached);
+               }))
+          {
+            cache->erase(handle);
+          }
+        }
+        catch(...)
+        {
+          cache->erase(handle);
+        }
+      }
+      return res;
     }
-    
+
     inline Result HandleClient::removeIndicesImpl(const std::string & handle, const std::vector<int> & indices)
     {
       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> optionsCopy(options);
@@ -158,8 +285,27 @@ namespace surfsara
       }
       optionsCopy.push_back(surfsara::curl::Delete());
       optionsCopy.push_back(surfsara::curl::Url(getUrlWithHandle(handle), params));
-      return curlRequest(optionsCopy);
-
+      Result res = curlRequest(optionsCopy);
+      if(cache)
+      {
+        try
+        {
+          if(!res.success ||
+             !cache->modify(handle, [&indices](Result & cached) {
+                 removeValues(cached.data.get(), indices);
+                 cached.curlResult.body = surfsara::ast::formatJson(cached.data);
+                 dropValidators(cached);
+               }))
+          {
+            cache->erase(handle);
+          }
+        }
+        catch(...)
+        {
+          cache->erase(handle);
+        }
+      }
+      return res;
     }
 
     inline Result HandleClient::removeImpl(const std::string & handle)
@@ -168,7 +314,17 @@ namespace surfsara
       optionsCopy.push_back(surfsara::curl::Header({"Content-Type:application/json", "Authorization: Handle clientCert=\"true\""}));
       optionsCopy.push_back(surfsara::curl::Delete());
       optionsCopy.push_back(surfsara::curl::Url(getUrlWithHandle(handle), {}));
-      return curlRequest(optionsCopy);
+      if(cache)
+      {
+        cache->erase(handle);
+      }
+      Result res = curlRequest(optionsCopy);
+      if(cache)
+      {
+        // a concurrent get may have cached the record while the DELETE was sent
+        cache->erase(handle);
+      }
+      return res;
     }
   }
 }
@@ -195,17 +351,85 @@ namespace surfsara
       }
     }
 
-    inline Result HandleClient::curlRequest(const std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> & optionsCopy)
+    inline bool HandleClient::extractResponse(Result & res, const std::string & body)
+    {
+      std::map<std::string, std::string> raw;
+      JsonScanner scanner(body);
+      if(!scanner.scanObject({"responseCode", "handle"}, raw))
+      {
+        return false;
+      }
+      auto itr = raw.find("responseCode");
+      if(itr != raw.end())
+      {
+        long code;
+        if(JsonScanner::decodeInteger(itr->second, code))
+        {
+          res.handleCode = code;
+        }
+      }
+      itr = raw.find("handle");
+      if(itr != raw.end())
+      {
+        std::string handle;
+        if(JsonScanner::decodeString(itr->second, handle))
+        {
+          res.handle = handle;
+        }
+      }
+      return true;
+    }
+
+    inline std::vector<std::string> HandleClient::conditionalHeaders(const Result & cached)
+    {
+      std::vector<std::string> headers;
+      std::string etag = cached.curlResult.getHeader("etag");
+      std::string lastModified = cached.curlResult.getHeader("last-modified");
+      if(!etag.empty())
+      {
+        // If-Modified-Since is ignored by the server if If-None-Match is present
+        headers.push_back(std::string("If-None-Match: ") + etag);
+      }
+      else if(!lastModified.empty())
+      {
+        headers.push_back(std::string("If-Modified-Since: ") + lastModified);
+      }
+      return headers;
+    }
+
+    inline void HandleClient::dropValidators(Result & cached)
+    {
+      cached.curlResult.headers.erase("etag");
+      cached.curlResult.headers.erase("last-modified");
+    }
+
+    inline Result HandleClient::curlRequest(const std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> & optionsCopy,
+                                            bool keepTree)
     {
       using namespace surfsara::ast;
       Result res;
 
       surfsara::curl::Curl curl(optionsCopy);
       res.curlResult = curl.request();
+      if(res.curlResult.httpCode == 304)
+      {
+        // conditional request, no body
+        return res;
+      }
       try
       {
-        res.data = surfsara::ast::parseJson(res.curlResult.body);
-        extractResponse(res, res.data);
+        // a body is parsed at most once: a tree built here is kept,
+        // otherwise it is built on first access of data
+        if(!keepTree && extractResponse(res, res.curlResult.body))
+        {
+          res.setLazyData();
+        }
+        else
+        {
+          Node json = surfsara::ast::parseJson(res.curlResult.body);
+          extractResponse(res, json);
+          res.data = std::move(json);
+        }
       }
       catch(...)
       {
@@ -217,10 +441,7 @@ namespace surfsara
 
     std::string HandleClient::generateHandle(const std::string & prefix)
     {
-      std::stringstream tmp;
-      boost::uuids::random_generator gen;
-      tmp << gen();
-      return surfsara::util::joinPath(prefix, tmp.str());
+      return surfsara::util::joinPath(prefix, suffixGenerator->generate());
     }
 
     const std::string& HandleClient::getUrl() const
@@ -232,5 +453,23 @@ namespace surfsara
     {
       return surfsara::util::joinPath(url, handle);
     }
+
+    surfsara::util::CacheStatistics HandleClient::getCacheStatistics() const
+    {
+      if(cache)
+      {
+        return cache->getStatistics();
+      }
+      else
+      {
+        return surfsara::util::CacheStatistics();
+      }
+    }
+
+    std::size_t HandleClient::recordSize(const std::string & handle, const Result & res)
+    {
+      // the decoded tree is accounted with the size of its JSON representation
+      return sizeof(Result) + handle.size() + 2 * res.curlResult.body.size();
+    }
   }
 }
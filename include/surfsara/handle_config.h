@@ -30,7 +30,10 @@ limitations under the License.
 #include <surfsara/json_format.h>
 #include <surfsara/handle_client.h>
 #include <surfsara/reverse_lookup_client.h>
+#include <surfsara/lookup_planner.h>
 #include <surfsara/irods_handle_client.h>
+#include <surfsara/write_behind_handle_client.h>
+#include <surfsara/routing_handle_client.h>
 #include <surfsara/handle_profile.h>
 #include <surfsara/handle_permissions.h>
 
@@ -103,8 +106,38 @@ namespace surfsara
       inline std::shared_ptr<Operation> parseArgs(int argc, const char ** argv);
       
       inline std::shared_ptr<HandleClient> makeHandleClient() const;
+
+      /**
+       * Client for all prefixes in handle_routes (and handle_prefix),
+       * same as makeHandleClient if no routes are configured.
+       */
+      inline std::shared_ptr<I_HandleClient> makeRoutedHandleClient() const;
       inline std::shared_ptr<ReverseLookupClient> makeReverseLookupClient() const;
+
+      /**
+       * Reverse lookup client for multi filter queries, planned by
+       * selectivity if lookup_planner is set.
+       */
+      inline std::shared_ptr<I_ReverseLookupClient> makeLookupClient() const;
       inline std::shared_ptr<IRodsHandleClient> makeIRodsHandleClient() const;
+
+      /**
+       * Send the writes deferred by handle_write_behind and print the
+       * failed ones to stderr. Called before a CLI command exits, since
+       * deferred writes are acknowledged before they reach the server.
+       * @return number of failed writes
+       */
+      inline std::size_t flushWriteBehind() const;
+
+      /**
+       * Bloom filter of lookup_bloom_filter, nullptr if not configured.
+       */
+      inline std::shared_ptr<surfsara::util::BloomFilter> makeBloomFilter() const;
+
+      /**
+       * Path index of irods_path_index, nullptr if not configured.
+       */
+      inline std::shared_ptr<surfsara::util::PathIndex> makePathIndex() const;
       inline std::shared_ptr<Permissions> getReadPermissions() const;
       inline std::shared_ptr<Permissions> getCreatePermissions() const;
       inline std::shared_ptr<Permissions> getWritePermissions() const;
@@ -145,6 +178,17 @@ namespace surfsara
       std::shared_ptr<Cli::Value<surfsara::ast::Node>> handle_profile;
       std::shared_ptr<Cli::Value<long>>                handle_index_from;
       std::shared_ptr<Cli::Value<long>>                handle_index_to;
+      std::shared_ptr<Cli::Value<long>>                handle_cache_size;
+      std::shared_ptr<Cli::Value<long>>                handle_cache_bytes;
+      std::shared_ptr<Cli::Value<long>>                handle_cache_ttl;
+      std::shared_ptr<Cli::Value<std::string>>         handle_suffix_scheme;
+      std::shared_ptr<Cli::Value<std::string>>         handle_suffix_node;
+      std::shared_ptr<Cli::Value<long>>                handle_write_behind;
+      std::shared_ptr<Cli::Value<std::string>>         handle_write_behind_journal;
+      std::shared_ptr<Cli::Value<surfsara::ast::Node>> handle_routes;
+      std::shared_ptr<Cli::Value<std::string>>         handle_create_policy;
+      std::shared_ptr<Cli::Value<long>>                handle_concurrency;
+      std::shared_ptr<Cli::Value<long>>                handle_rate_limit;
 
       // lookup
       std::shared_ptr<Cli::Value<std::string>> lookup_url;
@@ -157,9 +201,21 @@ namespace surfsara
       std::shared_ptr<Cli::Value<std::string>> lookup_caCertPath;
       std::shared_ptr<Cli::Value<long>>        lookup_limit;
       std::shared_ptr<Cli::Value<long>>        lookup_page;
+      std::shared_ptr<Cli::Value<long>>        lookup_target_latency;
+      std::shared_ptr<Cli::Value<long>>        lookup_limit_min;
+      std::shared_ptr<Cli::Value<long>>        lookup_limit_max;
+      std::shared_ptr<Cli::Value<long>>        lookup_prefetch;
+      std::shared_ptr<Cli::Value<long>>        lookup_concurrency;
+      std::shared_ptr<Cli::Flag>               lookup_retrieve_records;
+      std::shared_ptr<Cli::Flag>               lookup_planner;
+      std::shared_ptr<Cli::Value<std::string>> lookup_planner_statistics;
+      std::shared_ptr<Cli::Value<long>>        lookup_planner_verify;
       std::shared_ptr<Cli::Flag>               lookup_before_create;
       std::shared_ptr<Cli::Value<std::string>> lookup_key;
       std::shared_ptr<Cli::Value<std::string>> lookup_value;
+      std::shared_ptr<Cli::Value<std::string>> lookup_bloom_filter;
+      std::shared_ptr<Cli::Value<long>>        lookup_bloom_capacity;
+      std::shared_ptr<Cli::Value<long>>        lookup_bloom_bits;
 
 
       // irods arguments
@@ -168,6 +224,12 @@ namespace surfsara
       std::shared_ptr<Cli::Value<std::string>> irods_url_prefix;
       std::shared_ptr<Cli::Value<std::string>> irods_webdav_prefix;
       std::shared_ptr<Cli::Value<long>>        irods_webdav_port;
+      std::shared_ptr<Cli::Value<long>>        irods_path_cache_size;
+      std::shared_ptr<Cli::Value<long>>        irods_path_cache_ttl;
+      std::shared_ptr<Cli::Value<long>>        irods_negative_cache_size;
+      std::shared_ptr<Cli::Value<long>>        irods_negative_cache_ttl;
+      std::shared_ptr<Cli::Value<std::string>> irods_path_index;
+      std::shared_ptr<Cli::Value<long>>        irods_path_index_slots;
 
       Cli::Parser parser;
 
@@ -177,6 +239,8 @@ namespace surfsara
       std::set<std::string> configGroups;
       long index_from;
       long index_to;
+      // write behind clients of makeIRodsHandleClient, flushed by flushWriteBehind
+      mutable std::vector<std::shared_ptr<WriteBehindHandleClient>> writeBehindClients;
 
       template<typename T>
       inline void addOperation();
@@ -190,6 +254,11 @@ namespace surfsara
       // convert cli argument to node
       inline surfsara::ast::Node argumentToNode(std::shared_ptr<Cli::Argument> arg) const;
 
+      inline std::shared_ptr<RecordCache> makeRecordCache() const;
+      inline std::shared_ptr<HandleClient> makeHandleClient(const surfsara::ast::Node & endpoint,
+                                                            std::shared_ptr<RecordCache> cache,
+                                                            std::shared_ptr<I_SuffixGenerator> suffixGenerator) const;
+
       inline void updateParameters();
     };
   }
@@ -252,6 +321,17 @@ namespace surfsara
       /* @todo better solution for default value */
       handle_index_from   = parser.addValue<long>(index_from, "handle_index_from", Cli::Doc("Begin of free index range"));
       handle_index_to     = parser.addValue<long>(index_to, "handle_index_to", Cli::Doc("End of free index range index in range (index_from, index_to]"));
+      handle_cache_size   = parser.addValue<long>("handle_cache_size", Cli::Doc("Maximum number of cached handle records (default: 0, no cache)"));
+      handle_cache_bytes  = parser.addValue<long>("handle_cache_bytes", Cli::Doc("Maximum size of the handle record cache in bytes (default: unlimited)"));
+      handle_cache_ttl    = parser.addValue<long>("handle_cache_ttl", Cli::Doc("Time to live of cached handle records in seconds (default: 60)"));
+      handle_suffix_scheme = parser.addValue<std::string>("handle_suffix_scheme", Cli::Doc("Suffix of new handles: uuid4 (default), uuid7 (time ordered) or counter"));
+      handle_suffix_node  = parser.addValue<std::string>("handle_suffix_node", Cli::Doc("Node id for the counter suffix scheme (default: hostname)"));
+      handle_write_behind = parser.addValue<long>("handle_write_behind", Cli::Doc("Buffer updates of a handle for the given milliseconds and send them at once, failed writes are reported before exit (default: 0, write through)"));
+      handle_write_behind_journal = parser.addValue<std::string>("handle_write_behind_journal", Cli::Doc("File to which failed deferred writes are appended as JSON lines"));
+      handle_routes       = parser.addValue<surfsara::ast::Node>("handle_routes", Cli::Doc("Handle servers by prefix: {\"PREFIX\": {\"url\": ..., \"port\": ..., \"cert\": ..., \"key\": ..., \"cacert\": ..., \"cacert_path\": ..., \"insecure\": ...}}, missing keys default to the handle_* options"));
+      handle_create_policy = parser.addValue<std::string>("handle_create_policy", Cli::Doc("Prefix of new handles with handle_routes: default (handle_prefix) or round_robin"));
+      handle_concurrency  = parser.addValue<long>("handle_concurrency", Cli::Doc("Maximum number of concurrent requests to the handle server of bulk operations (default: 8)"));
+      handle_rate_limit   = parser.addValue<long>("handle_rate_limit", Cli::Doc("Maximum number of requests per second to the handle server of bulk deletes (default: 0, unlimited)"));
       
       // reverse lookup arguments
       lookup_url          = parser.addValue<std::string>("lookup_url", Cli::Doc("Url to reverse lookup server "));
@@ -264,9 +344,21 @@ namespace surfsara
       lookup_caCertPath   = parser.addValue<std::string>("lookup_cacert_path", Cli::Doc("CA certificate directory to verify peer against"));
       lookup_limit        = parser.addValue<long>("lookup_limit", Cli::Doc("Pagination Limit"));
       lookup_page         = parser.addValue<long>("lookup_page", Cli::Doc("Pagination Page"));
+      lookup_target_latency = parser.addValue<long>("lookup_target_latency", Cli::Doc("Adapt the page size when streaming lookup results to this response time in milliseconds (default: 0, fixed lookup_limit)"));
+      lookup_limit_min    = parser.addValue<long>("lookup_limit_min", Cli::Doc("Smallest adaptive page size (default: 16)"));
+      lookup_limit_max    = parser.addValue<long>("lookup_limit_max", Cli::Doc("Largest adaptive page size (default: 4096)"));
+      lookup_prefetch     = parser.addValue<long>("lookup_prefetch", Cli::Doc("Maximum number of pages fetched concurrently when streaming lookup results (default: 0, one after another)"));
+      lookup_concurrency  = parser.addValue<long>("lookup_concurrency", Cli::Doc("Maximum number of concurrent requests when looking up several paths (default: 4)"));
+      lookup_retrieve_records = parser.addFlag("lookup_retrieve_records", Cli::Doc("The reverse lookup server returns the records with the handles (retrieverecords=true), irods operations skip the separate GET"));
+      lookup_planner      = parser.addFlag("lookup_planner", Cli::Doc("Send the most selective filter of a multi filter lookup first and check the other filters client-side"));
+      lookup_planner_statistics = parser.addValue<std::string>("lookup_planner_statistics", Cli::Doc("File in which the planner keeps the result counts of previous lookups"));
+      lookup_planner_verify = parser.addValue<long>("lookup_planner_verify", Cli::Doc("Maximum number of candidate handles of which the planner fetches the records (default: 16)"));
       lookup_key          = parser.addValue<std::string>("lookup_key", Cli::Doc("The key that identifies the object in reverse lookup"));
       lookup_value         = parser.addValue<std::string>("lookup_value", Cli::Doc("The template of the value that identifies the object in reverse lookup"));
       lookup_before_create = parser.addFlag("lookup_before_create", Cli::Doc("Perform lookup query before creating a new handle"));
+      lookup_bloom_filter = parser.addValue<std::string>("lookup_bloom_filter", Cli::Doc("File of a bloom filter of existing lookup values, skips the lookup before create for new values once built with bloom_build. Every process that creates handles must use the same file"));
+      lookup_bloom_capacity = parser.addValue<long>("lookup_bloom_capacity", Cli::Doc("Expected number of lookup values in a new bloom filter (default: 1000000)"));
+      lookup_bloom_bits   = parser.addValue<long>("lookup_bloom_bits", Cli::Doc("Bits per value of a new bloom filter, 10: 1% false positives, 16: 0.05% (default: 16)"));
 
       // irods setting
       irods_server        = parser.addValue<std::string>("irods_server", Cli::Doc("FQDN or IP of the ICat server"));
@@ -274,6 +366,12 @@ namespace surfsara
       irods_url_prefix    = parser.addValue<std::string>("irods_url_prefix", Cli::Doc("Prefix for the irods server, default: irods://{irods_server}"));
       irods_webdav_prefix = parser.addValue<std::string>("irods_webdav_prefix", Cli::Doc("Prefix for the webdav server (Optional)"));
       irods_webdav_port   = parser.addValue<long>("irods_webdav_port", Cli::Doc("Webdav server port, default: 80"));
+      irods_path_cache_size = parser.addValue<long>("irods_path_cache_size", Cli::Doc("Maximum number of cached path to handle lookups (default: 0, no cache)"));
+      irods_path_cache_ttl = parser.addValue<long>("irods_path_cache_ttl", Cli::Doc("Time to live of cached path to handle lookups in seconds (default: 60)"));
+      irods_negative_cache_size = parser.addValue<long>("irods_negative_cache_size", Cli::Doc("Maximum number of cached lookups that found no handle (default: 0, no cache)"));
+      irods_negative_cache_ttl = parser.addValue<long>("irods_negative_cache_ttl", Cli::Doc("Time to live of cached lookups that found no handle in seconds (default: 5)"));
+      irods_path_index    = parser.addValue<std::string>("irods_path_index", Cli::Doc("File of a persistent path to handle index, consulted before the reverse lookup (rebuild with index_rebuild)"));
+      irods_path_index_slots = parser.addValue<long>("irods_path_index_slots", Cli::Doc("Number of slots of a new path index, at most 3/4 are used (default: 262144, 128 bytes each)"));
     }
 
     inline void Config::parseJson(const std::string & filename, bool _verbose)
@@ -407,18 +505,96 @@ namespace surfsara
 
     inline std::shared_ptr<HandleClient> Config::makeHandleClient() const
     {
+      return makeHandleClient(surfsara::ast::Object(),
+                              makeRecordCache(),
+                              makeSuffixGenerator(handle_suffix_scheme->isSet() ? handle_suffix_scheme->getValue() : "",
+                                                  handle_suffix_node->isSet() ? handle_suffix_node->getValue() : ""));
+    }
+
+    inline std::shared_ptr<I_HandleClient> Config::makeRoutedHandleClient() const
+    {
+      using Object = surfsara::ast::Object;
+      auto routesNode = handle_routes->getValue();
+      if(!routesNode.isA<Object>())
+      {
+        return makeHandleClient();
+      }
+      // one cache for all servers, the handles include the prefix
+      auto cache = makeRecordCache();
+      auto suffixGenerator = makeSuffixGenerator(handle_suffix_scheme->isSet() ? handle_suffix_scheme->getValue() : "",
+                                                 handle_suffix_node->isSet() ? handle_suffix_node->getValue() : "");
+      std::map<std::string, std::shared_ptr<I_HandleClient>> routes;
+      routesNode.as<Object>().forEach([this, &routes, &cache, &suffixGenerator](const std::string & prefix,
+                                                                                 const surfsara::ast::Node & endpoint) {
+          if(!endpoint.isA<Object>())
+          {
+            throw std::logic_error(std::string("handle_routes: expected object for prefix ") + prefix);
+          }
+          routes[prefix] = makeHandleClient(endpoint, cache, suffixGenerator);
+        });
+      if(handle_url->isSet() && handle_prefix->isSet() &&
+         routes.find(handle_prefix->getValue()) == routes.end())
+      {
+        routes[handle_prefix->getValue()] = makeHandleClient(Object(), cache, suffixGenerator);
+      }
+      return std::make_shared<RoutingHandleClient>(routes,
+                                                   RoutingHandleClient::parsePolicy(handle_create_policy->isSet() ?
+                                                                                    handle_create_policy->getValue() : ""));
+    }
+
+    inline std::shared_ptr<RecordCache> Config::makeRecordCache() const
+    {
+      std::shared_ptr<RecordCache> cache;
+      if(handle_cache_size->isSet() && handle_cache_size->getValue() > 0)
+      {
+        cache = std::make_shared<RecordCache>(handle_cache_size->getValue(),
+                                              (handle_cache_bytes->isSet() ? handle_cache_bytes->getValue() : 0),
+                                              std::chrono::seconds(handle_cache_ttl->isSet() ? handle_cache_ttl->getValue() : 60),
+                                              &HandleClient::recordSize);
+      }
+      return cache;
+    }
+
+    inline std::shared_ptr<HandleClient> Config::makeHandleClient(const surfsara::ast::Node & endpoint,
+                                                                  std::shared_ptr<RecordCache> cache,
+                                                                  std::shared_ptr<I_SuffixGenerator> suffixGenerator) const
+    {
+      using Object = surfsara::ast::Object;
+      using String = surfsara::ast::String;
+      using Integer = surfsara::ast::Integer;
+      using Boolean = surfsara::ast::Boolean;
+      // settings of the endpoint override the handle_* options
+      auto getString = [&endpoint](const std::string & key, const std::string & def) {
+        if(endpoint.isA<Object>() && endpoint.as<Object>().has(key) && endpoint.as<Object>().get(key).isA<String>())
+        {
+          return std::string(endpoint.as<Object>().get(key).as<String>());
+        }
+        return def;
+      };
+      long port = handle_port->getValue();
+      bool insecure = handle_insecure->isSet();
+      if(endpoint.isA<Object>() && endpoint.as<Object>().has("port") && endpoint.as<Object>().get("port").isA<Integer>())
+      {
+        port = endpoint.as<Object>().get("port").as<Integer>();
+      }
+      if(endpoint.isA<Object>() && endpoint.as<Object>().has("insecure") && endpoint.as<Object>().get("insecure").isA<Boolean>())
+      {
+        insecure = endpoint.as<Object>().get("insecure").as<Boolean>();
+      }
       std::string passphrase;
-      return std::make_shared<HandleClient>(handle_url->getValue(),
+      return std::make_shared<HandleClient>(getString("url", handle_url->getValue()),
                                             std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>>{
                                               surfsara::curl::Verbose(curl_verbose->isSet()),
-                                              surfsara::curl::Port(handle_port->getValue()),
-                                              surfsara::curl::SslPem(handle_cert->getValue(),
-                                                                     handle_key->getValue(),
-                                                                     handle_insecure->isSet(),
+                                              surfsara::curl::Port(port),
+                                              surfsara::curl::SslPem(getString("cert", handle_cert->getValue()),
+                                                                     getString("key", handle_key->getValue()),
+                                                                     insecure,
                                                                      passphrase,
-                                                                     handle_caCert->getValue(),
-                                                                     handle_caCertPath->getValue())},
-                                            verbose->isSet());
+                                                                     getString("cacert", handle_caCert->getValue()),
+                                                                     getString("cacert_path", handle_caCertPath->getValue()))},
+                                            verbose->isSet(),
+                                            cache,
+                                            suffixGenerator);
     }
 
     inline std::shared_ptr<ReverseLookupClient> Config::makeReverseLookupClient() const
@@ -435,7 +611,45 @@ namespace surfsara
                                                                               lookup_caCertPath->getValue())},
                                                    (lookup_limit->isSet() ? lookup_limit->getValue() : 100),
                                                    (lookup_page->isSet() ? lookup_page->getValue() : 0),
-                                                   verbose->isSet());
+                                                   verbose->isSet(),
+                                                   (lookup_prefetch->isSet() ? lookup_prefetch->getValue() : 0),
+                                                   (lookup_concurrency->isSet() ? lookup_concurrency->getValue() : 4),
+                                                   lookup_retrieve_records->isSet(),
+                                                   AdaptivePaging((lookup_limit_min->isSet() ? lookup_limit_min->getValue() : 16),
+                                                                  (lookup_limit_max->isSet() ? lookup_limit_max->getValue() : 4096),
+                                                                  std::chrono::milliseconds(lookup_target_latency->isSet() ?
+                                                                                            lookup_target_latency->getValue() : 0)));
+    }
+
+    inline std::shared_ptr<I_ReverseLookupClient> Config::makeLookupClient() const
+    {
+      std::shared_ptr<I_ReverseLookupClient> client = makeReverseLookupClient();
+      if(lookup_planner->isSet())
+      {
+        auto planner = std::make_shared<LookupPlanner>(lookup_planner_statistics->isSet() ?
+                                                       lookup_planner_statistics->getValue() : "");
+        client = std::make_shared<PlannedReverseLookupClient>(client,
+                                                              planner,
+                                                              (lookup_limit->isSet() ? lookup_limit->getValue() : 100),
+                                                              makeRoutedHandleClient(),
+                                                              (lookup_planner_verify->isSet() ? lookup_planner_verify->getValue() : 16));
+      }
+      return client;
+    }
+
+    inline std::size_t Config::flushWriteBehind() const
+    {
+      std::size_t failed = 0;
+      for(auto & client : writeBehindClients)
+      {
+        client->flush();
+        for(auto & error : client->takeErrors())
+        {
+          std::cerr << "deferred write failed: " << surfsara::ast::formatJson(error.toNode()) << std::endl;
+          failed++;
+        }
+      }
+      return failed;
     }
 
     inline std::shared_ptr<IRodsHandleClient> Config::makeIRodsHandleClient() const
@@ -454,13 +668,64 @@ namespace surfsara
                                                   index_from,
                                                   index_to);
       }
-      return std::make_shared<IRodsHandleClient>(makeHandleClient(),
+      std::shared_ptr<I_HandleClient> handleClient = makeRoutedHandleClient();
+      if(handle_write_behind->isSet() && handle_write_behind->getValue() > 0)
+      {
+        auto writeBehind = std::make_shared<WriteBehindHandleClient>(handleClient,
+                                                                     std::chrono::milliseconds(handle_write_behind->getValue()),
+                                                                     handle_write_behind_journal->isSet() ?
+                                                                     handle_write_behind_journal->getValue() : "");
+        writeBehindClients.push_back(writeBehind);
+        handleClient = writeBehind;
+      }
+      std::shared_ptr<PathCache> pathCache;
+      if(irods_path_cache_size->isSet() && irods_path_cache_size->getValue() > 0)
+      {
+        pathCache = std::make_shared<PathCache>(irods_path_cache_size->getValue(),
+                                                0,
+                                                std::chrono::seconds(irods_path_cache_ttl->isSet() ? irods_path_cache_ttl->getValue() : 60));
+      }
+      std::shared_ptr<NegativeCache> negativeCache;
+      if(irods_negative_cache_size->isSet() && irods_negative_cache_size->getValue() > 0)
+      {
+        negativeCache = std::make_shared<NegativeCache>(irods_negative_cache_size->getValue(),
+                                                        0,
+                                                        std::chrono::seconds(irods_negative_cache_ttl->isSet() ? irods_negative_cache_ttl->getValue() : 5));
+      }
+      return std::make_shared<IRodsHandleClient>(handleClient,
                                                  handle_prefix->getValue(),
                                                  makeReverseLookupClient(),
                                                  profile,
                                                  lookup_before_create->isSet(),
                                                  lookup_key->getValue(),
-                                                 lookup_value->getValue());
+                                                 lookup_value->getValue(),
+                                                 pathCache,
+                                                 negativeCache,
+                                                 makeBloomFilter(),
+                                                 makePathIndex());
+    }
+
+    inline std::shared_ptr<surfsara::util::PathIndex> Config::makePathIndex() const
+    {
+      std::shared_ptr<surfsara::util::PathIndex> index;
+      if(irods_path_index->isSet() && !irods_path_index->getValue().empty())
+      {
+        index = std::make_shared<surfsara::util::PathIndex>(irods_path_index->getValue(),
+                                                            irods_path_index_slots->isSet() ? irods_path_index_slots->getValue() : 262144);
+      }
+      return index;
+    }
+
+    inline std::shared_ptr<surfsara::util::BloomFilter> Config::makeBloomFilter() const
+    {
+      std::shared_ptr<surfsara::util::BloomFilter> filter;
+      if(lookup_bloom_filter->isSet() && !lookup_bloom_filter->getValue().empty())
+      {
+        filter = std::make_shared<surfsara::util::BloomFilter>(lookup_bloom_capacity->isSet() ? lookup_bloom_capacity->getValue() : 1000000,
+                                                               lookup_bloom_bits->isSet() ? lookup_bloom_bits->getValue() : 16,
+                                                               lookup_bloom_filter->getValue());
+      }
+      return filter;
     }
 
     inline std::shared_ptr<Permissions> Config::getReadPermissions() const
@@ -528,7 +793,7 @@ namespace surfsara
         if(!arg->isA<surfsara::ast::Node>() && arg->isSet())
         {
           std::string name = arg->getName();
-          if(!name.empty() && name != "handle_profile")
+          if(!name.empty() && name != "handle_profile" && name != "handle_routes")
           {
             std::transform(name.begin(), name.end(),
                            name.begin(), ::toupper);
@@ -17,7 +17,9 @@ limitations under the License.
 */
 #pragma once
 #include <iostream>
+#include <utility>
 #include <surfsara/ast.h>
+#include <surfsara/json_parser.h>
 #include <surfsara/curl.h>
 
 namespace surfsara
@@ -26,6 +28,48 @@ namespace surfsara
   {
     using Node = ::surfsara::ast::Node;
 
+    /**
+     * JSON document that is decoded from the raw response body
+     * on first access.
+     * The first access is not synchronized, do not share an undecoded
+     * instance between threads.
+     */
+    class LazyNode
+    {
+    public:
+      LazyNode() : source(nullptr), decoded(true) {}
+      LazyNode(const surfsara::ast::Node & _node) : source(nullptr), node(_node), decoded(true) {}
+
+      inline LazyNode & operator=(const surfsara::ast::Node & _node);
+      inline LazyNode & operator=(surfsara::ast::Node && _node);
+
+      /**
+       * Decoded document, throws if the body is not valid JSON.
+       */
+      inline surfsara::ast::Node & get();
+      inline const surfsara::ast::Node & get() const;
+
+      operator surfsara::ast::Node & ()
+      {
+        return get();
+      }
+
+      operator const surfsara::ast::Node & () const
+      {
+        return get();
+      }
+
+      inline bool isDecoded() const;
+
+    private:
+      friend struct Result;
+      inline void setSource(const std::string * _source, bool lazy);
+      inline void decode() const;
+      const std::string * source;
+      mutable surfsara::ast::Node node;
+      mutable bool decoded;
+    };
+
     struct Result
     {
       ::surfsara::curl::Result curlResult;
@@ -33,12 +77,46 @@ namespace surfsara
       bool        jsonDecodeError;
       bool        success;
       std::string handle;
-      surfsara::ast::Node data;
+      // decoded from curlResult.body when accessed
+      LazyNode    data;
 
       Result() :
         handleCode(0),
         jsonDecodeError(false),
-        success(false) {}
+        success(false)
+      {
+        data.setSource(&curlResult.body, false);
+      }
+
+      Result(const Result & other) :
+        curlResult(other.curlResult),
+        handleCode(other.handleCode),
+        jsonDecodeError(other.jsonDecodeError),
+        success(other.success),
+        handle(other.handle),
+        data(other.data)
+      {
+        data.setSource(&curlResult.body, !other.data.isDecoded());
+      }
+
+      Result(Result && other) :
+        curlResult(std::move(other.curlResult)),
+        handleCode(other.handleCode),
+        jsonDecodeError(other.jsonDecodeError),
+        success(other.success),
+        handle(std::move(other.handle)),
+        data(std::move(other.data))
+      {
+        data.setSource(&curlResult.body, !data.isDecoded());
+      }
+
+      inline Result & operator=(const Result & other);
+      inline Result & operator=(Result && other);
+
+      /**
+       * Defer decoding of the response body to the first access of data.
+       */
+      inline void setLazyData();
     };
 
     /* helper functions */
@@ -56,6 +134,88 @@ namespace surfsara
 {
   namespace handle
   {
+    inline LazyNode & LazyNode::operator=(const surfsara::ast::Node & _node)
+    {
+      node = _node;
+      decoded = true;
+      return *this;
+    }
+
+    inline LazyNode & LazyNode::operator=(surfsara::ast::Node && _node)
+    {
+      node = std::move(_node);
+      decoded = true;
+      return *this;
+    }
+
+    inline surfsara::ast::Node & LazyNode::get()
+    {
+      decode();
+      return node;
+    }
+
+    inline const surfsara::ast::Node & LazyNode::get() const
+    {
+      decode();
+      return node;
+    }
+
+    inline bool LazyNode::isDecoded() const
+    {
+      return decoded;
+    }
+
+    inline void LazyNode::setSource(const std::string * _source, bool lazy)
+    {
+      source = _source;
+      if(lazy)
+      {
+        node = surfsara::ast::Node();
+        decoded = false;
+      }
+    }
+
+    inline void LazyNode::decode() const
+    {
+      if(!decoded)
+      {
+        if(source)
+        {
+          node = surfsara::ast::parseJson(*source);
+        }
+        decoded = true;
+      }
+    }
+
+    inline Result & Result::operator=(const Result & other)
+    {
+      curlResult = other.curlResult;
+      handleCode = other.handleCode;
+      jsonDecodeError = other.jsonDecodeError;
+      success = other.success;
+      handle = other.handle;
+      data = other.data;
+      data.setSource(&curlResult.body, !other.data.isDecoded());
+      return *this;
+    }
+
+    inline Result & Result::operator=(Result && other)
+    {
+      curlResult = std::move(other.curlResult);
+      handleCode = other.handleCode;
+      jsonDecodeError = other.jsonDecodeError;
+      success = other.success;
+      handle = std::move(other.handle);
+      data = std::move(other.data);
+      data.setSource(&curlResult.body, !data.isDecoded());
+      return *this;
+    }
+
+    inline void Result::setLazyData()
+    {
+      data.setSource(&curlResult.body, true);
+    }
+
     inline ::std::ostream & operator<<(::std::ostream & ost, const Result & res)
     {
       ost << res.curlResult << std::endl
@@ -0,0 +1,261 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <cstdint>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    /**
+     * Generates the suffix of a new handle.
+     * Implementations must be safe to call from concurrent threads.
+     */
+    struct I_SuffixGenerator
+    {
+      virtual ~I_SuffixGenerator() {}
+      virtual std::string generate() = 0;
+    };
+
+    /**
+     * Random UUID (version 4) from a thread local engine that is seeded
+     * once per thread (and again after fork).
+     */
+    class UuidV4SuffixGenerator : public I_SuffixGenerator
+    {
+    public:
+      inline std::string generate() override;
+    };
+
+    /**
+     * Time ordered UUID (version 7).
+     * The 48 bit millisecond timestamp is followed by a 12 bit sequence
+     * that keeps the suffixes monotonic within the process, the remaining
+     * 62 bits are random to avoid collisions between processes.
+     * Suffixes generated in a row sort next to each other, so that
+     * inserts of a bulk job land in adjacent pages of the server's index.
+     */
+    class UuidV7SuffixGenerator : public I_SuffixGenerator
+    {
+    public:
+      inline std::string generate() override;
+    private:
+      inline static std::uint64_t nextTimestamp();
+    };
+
+    /**
+     * Suffix of the form <NODE>-<SESSION>-<COUNTER>.
+     * The session is random per generator instance, so that restarted
+     * processes on the same node do not reuse suffixes.
+     */
+    class CounterSuffixGenerator : public I_SuffixGenerator
+    {
+    public:
+      CounterSuffixGenerator(const std::string & _nodeId);
+      inline std::string generate() override;
+    private:
+      std::string nodeId;
+      std::string session;
+      std::atomic<std::uint64_t> counter;
+    };
+
+    /**
+     * Create a suffix generator by name: uuid4 (default), uuid7 or counter.
+     */
+    inline std::shared_ptr<I_SuffixGenerator> makeSuffixGenerator(const std::string & scheme,
+                                                                  const std::string & nodeId = "");
+
+    namespace details
+    {
+      inline std::mt19937_64 & threadLocalEngine();
+      inline void formatHex(std::uint64_t value, int digits, char * buffer);
+      inline std::string formatUuid(std::uint64_t hi, std::uint64_t lo);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    namespace details
+    {
+      inline std::atomic<unsigned> & forkGeneration()
+      {
+        static std::atomic<unsigned> generation(0);
+        return generation;
+      }
+
+      inline void onFork()
+      {
+        forkGeneration()++;
+      }
+
+      inline std::mt19937_64 & threadLocalEngine()
+      {
+        static std::once_flag atforkRegistered;
+        static thread_local std::mt19937_64 engine;
+        static thread_local bool seeded = false;
+        static thread_local unsigned generation = 0;
+        std::call_once(atforkRegistered, []() {
+            pthread_atfork(nullptr, nullptr, &onFork);
+          });
+        if(!seeded || generation != forkGeneration())
+        {
+          // a forked child must not continue the sequence of its parent
+          std::random_device rd;
+          auto now = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+          auto tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+          std::seed_seq seq{rd(), rd(), rd(), rd(),
+                            static_cast<std::uint32_t>(now),
+                            static_cast<std::uint32_t>(now >> 32),
+                            static_cast<std::uint32_t>(tid)};
+          engine.seed(seq);
+          seeded = true;
+          generation = forkGeneration();
+        }
+        return engine;
+      }
+
+      inline void formatHex(std::uint64_t value, int digits, char * buffer)
+      {
+        static const char hex[] = "0123456789abcdef";
+        for(int i = digits - 1; i >= 0; i--)
+        {
+          buffer[i] = hex[value & 0xf];
+          value >>= 4;
+        }
+      }
+
+      inline std::string formatUuid(std::uint64_t hi, std::uint64_t lo)
+      {
+        // 8-4-4-4-12
+        std::string ret(36, '-');
+        formatHex(hi >> 32, 8, &ret[0]);
+        formatHex(hi >> 16, 4, &ret[9]);
+        formatHex(hi, 4, &ret[14]);
+        formatHex(lo >> 48, 4, &ret[19]);
+        formatHex(lo, 12, &ret[24]);
+        return ret;
+      }
+    }
+
+    inline std::string UuidV4SuffixGenerator::generate()
+    {
+      auto & engine = details::threadLocalEngine();
+      std::uint64_t hi = engine();
+      std::uint64_t lo = engine();
+      hi = (hi & 0xffffffffffff0fffULL) | 0x0000000000004000ULL; // version 4
+      lo = (lo & 0x3fffffffffffffffULL) | 0x8000000000000000ULL; // variant 10
+      return details::formatUuid(hi, lo);
+    }
+
+    inline std::uint64_t UuidV7SuffixGenerator::nextTimestamp()
+    {
+      // milliseconds << 12 | sequence, strictly increasing within the process
+      static std::atomic<std::uint64_t> state(0);
+      std::uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+      std::uint64_t now = ms << 12;
+      std::uint64_t prev = state.load();
+      std::uint64_t next;
+      do
+      {
+        // on sequence overflow the timestamp runs ahead of the clock
+        next = (now > prev) ? now : prev + 1;
+      }
+      while(!state.compare_exchange_weak(prev, next));
+      return next;
+    }
+
+    inline std::string UuidV7SuffixGenerator::generate()
+    {
+      std::uint64_t ts = nextTimestamp();
+      std::uint64_t hi = ((ts >> 12) << 16) | 0x7000ULL | (ts & 0xfffULL);
+      std::uint64_t lo = details::threadLocalEngine()();
+      lo = (lo & 0x3fffffffffffffffULL) | 0x8000000000000000ULL; // variant 10
+      return details::formatUuid(hi, lo);
+    }
+
+    inline CounterSuffixGenerator::CounterSuffixGenerator(const std::string & _nodeId)
+      : nodeId(_nodeId), session(8, '0'), counter(0)
+    {
+      details::formatHex(details::threadLocalEngine()(), 8, &session[0]);
+    }
+
+    inline std::string CounterSuffixGenerator::generate()
+    {
+      std::uint64_t value = counter++;
+      std::string ret;
+      ret.reserve(nodeId.size() + 1 + session.size() + 1 + 16);
+      ret.append(nodeId);
+      ret.push_back('-');
+      ret.append(session);
+      ret.push_back('-');
+      char buffer[16];
+      details::formatHex(value, 16, buffer);
+      ret.append(buffer, 16);
+      return ret;
+    }
+
+    inline std::shared_ptr<I_SuffixGenerator> makeSuffixGenerator(const std::string & scheme,
+                                                                  const std::string & nodeId)
+    {
+      if(scheme.empty() || scheme == "uuid4")
+      {
+        return std::make_shared<UuidV4SuffixGenerator>();
+      }
+      else if(scheme == "uuid7")
+      {
+        return std::make_shared<UuidV7SuffixGenerator>();
+      }
+      else if(scheme == "counter")
+      {
+        if(nodeId.empty())
+        {
+          char hostname[256] = {0};
+          gethostname(hostname, sizeof(hostname) - 1);
+          return std::make_shared<CounterSuffixGenerator>(hostname);
+        }
+        return std::make_shared<CounterSuffixGenerator>(nodeId);
+      }
+      else
+      {
+        throw std::invalid_argument(std::string("invalid handle suffix scheme '") + scheme +
+                                    "', expected uuid4, uuid7 or counter");
+      }
+    }
+  }
+}
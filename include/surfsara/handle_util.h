@@ -19,6 +19,7 @@ limitations under the License.
 #include <stdexcept>
 #include <vector>
 #include <set>
+#include <map>
 #include <string>
 #include <boost/algorithm/string/join.hpp>
 #include <surfsara/ast.h>
@@ -71,6 +72,41 @@ namespace surfsara
     inline void deepReplace(surfsara::ast::Node & node,
                             const std::map<std::string, std::string> & repl,
                             IndexAllocator & alloc);
+
+    /**
+     * Apply the values of an update request to a record:
+     * entries with the same index are replaced, new entries are appended.
+     */
+    inline void mergeValues(surfsara::ast::Node & root,
+                            const surfsara::ast::Node & update);
+
+    /**
+     * Remove the entries with the given indices from a record.
+     */
+    inline void removeValues(surfsara::ast::Node & root,
+                             const std::vector<int> & indices);
+
+    /**
+     * Entries of a record by index, formatted as JSON.
+     * Taken before a record is modified in place to compute the difference.
+     */
+    using RecordSnapshot = std::map<int, std::string>;
+    inline RecordSnapshot snapshotRecord(const surfsara::ast::Node & record);
+
+    struct RecordDiff
+    {
+      // {"values": [added and changed entries]}
+      surfsara::ast::Node update;
+      std::vector<int> removed;
+
+      inline bool hasUpdate() const;
+    };
+
+    /**
+     * Difference between a snapshot and the modified record.
+     */
+    inline RecordDiff diffRecords(const RecordSnapshot & before,
+                                  const surfsara::ast::Node & after);
   }
 }
 
@@ -388,7 +424,126 @@ namespace surfsara
           });
       }
     }
-  } // handle 
-} // surfsara
 
+    inline void mergeValues(surfsara::ast::Node & root,
+                            const surfsara::ast::Node & update)
+    {
+      using Node = surfsara::ast::Node;
+      using Object = surfsara::ast::Object;
+      using Array = surfsara::ast::Array;
+      using Integer = surfsara::ast::Integer;
+      std::map<int, Node> replacements;
+      getIndexArray(update).forEach([&replacements](const Node & n) {
+          if(n.isA<Object>() &&
+             n.as<Object>().has("index") &&
+             n.as<Object>().get("index").isA<Integer>())
+          {
+            replacements[n.as<Object>().get("index").as<Integer>()] = n;
+          }
+        });
+      Array values;
+      getIndexArray(root).forEach([&replacements, &values](const Node & n) {
+          if(n.isA<Object>() &&
+             n.as<Object>().has("index") &&
+             n.as<Object>().get("index").isA<Integer>())
+          {
+            auto itr = replacements.find(n.as<Object>().get("index").as<Integer>());
+            if(itr != replacements.end())
+            {
+              values.pushBack(itr->second);
+              replacements.erase(itr);
+              return;
+            }
+          }
+          values.pushBack(n);
+        });
+      for(auto & kv : replacements)
+      {
+        values.pushBack(kv.second);
+      }
+      root.as<Object>().set("values", values);
+    }
+
+    inline void removeValues(surfsara::ast::Node & root,
+                             const std::vector<int> & indices)
+    {
+      using Node = surfsara::ast::Node;
+      using Object = surfsara::ast::Object;
+      using Array = surfsara::ast::Array;
+      using Integer = surfsara::ast::Integer;
+      std::set<int> removed(indices.begin(), indices.end());
+      Array values;
+      getIndexArray(root).forEach([&removed, &values](const Node & n) {
+          if(n.isA<Object>() &&
+             n.as<Object>().has("index") &&
+             n.as<Object>().get("index").isA<Integer>() &&
+             removed.find(n.as<Object>().get("index").as<Integer>()) != removed.end())
+          {
+            return;
+          }
+          values.pushBack(n);
+        });
+      root.as<Object>().set("values", values);
+    }
+
+    inline RecordSnapshot snapshotRecord(const surfsara::ast::Node & record)
+    {
+      using Node = surfsara::ast::Node;
+      using Object = surfsara::ast::Object;
+      using Integer = surfsara::ast::Integer;
+      RecordSnapshot ret;
+      getIndexArray(record).forEach([&ret](const Node & n) {
+          if(n.isA<Object>() &&
+             n.as<Object>().has("index") &&
+             n.as<Object>().get("index").isA<Integer>())
+          {
+            ret[n.as<Object>().get("index").as<Integer>()] = surfsara::ast::formatJson(n);
+          }
+        });
+      return ret;
+    }
 
+    inline bool RecordDiff::hasUpdate() const
+    {
+      return getIndexArray(update).size() > 0;
+    }
+
+    inline RecordDiff diffRecords(const RecordSnapshot & before,
+                                  const surfsara::ast::Node & after)
+    {
+      using Node = surfsara::ast::Node;
+      using Object = surfsara::ast::Object;
+      using Array = surfsara::ast::Array;
+      using Integer = surfsara::ast::Integer;
+      std::set<int> kept;
+      Array values;
+      getIndexArray(after).forEach([&before, &kept, &values](const Node & n) {
+          if(n.isA<Object>() &&
+             n.as<Object>().has("index") &&
+             n.as<Object>().get("index").isA<Integer>())
+          {
+            int index = n.as<Object>().get("index").as<Integer>();
+            kept.insert(index);
+            auto itr = before.find(index);
+            if(itr != before.end() && itr->second == surfsara::ast::formatJson(n))
+            {
+              return;
+            }
+          }
+          values.pushBack(n);
+        });
+      RecordDiff diff;
+      Object update;
+      update.set("values", values);
+      diff.update = update;
+      for(auto & kv : before)
+      {
+        if(kept.find(kv.first) == kept.end())
+        {
+          diff.removed.push_back(kv.first);
+        }
+      }
+      return diff;
+    }
+  } // handle 
+} // surfsara
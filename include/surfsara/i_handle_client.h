@@ -28,9 +28,14 @@ namespace surfsara
       virtual ~I_HandleClient() {}
       virtual Result create(const std::string & prefix, const surfsara::ast::Node & node) = 0;
       virtual Result get(const std::string & handle) = 0;
+      /* get a subset of the record by index or by type */
+      virtual Result get(const std::string & handle, const std::vector<int> & indices) = 0;
+      virtual Result get(const std::string & handle, const std::vector<std::string> & types) = 0;
       virtual Result update(const std::string & handle, const surfsara::ast::Node & node) = 0;
       virtual Result removeIndices(const std::string & handle, const std::vector<int> & indices) = 0;
       virtual Result remove(const std::string & handle) = 0;
+      /* apply writes that have not been sent yet to a record that was read elsewhere */
+      virtual void overlay(const std::string &, Result &) {}
     };
   }
 }
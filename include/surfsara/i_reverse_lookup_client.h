@@ -19,6 +19,9 @@ limitations under the License.
 #include <vector>
 #include <string>
 #include <utility>
+#include <functional>
+#include <map>
+#include <surfsara/ast.h>
 
 namespace surfsara
 {
@@ -28,6 +31,75 @@ namespace surfsara
     {
       virtual ~I_ReverseLookupClient() {}
       virtual std::vector<std::string> lookup(const std::vector<std::pair<std::string, std::string>> & query) = 0;
+
+      /**
+       * Call func for each matching handle as the results arrive,
+       * until all pages are fetched or func returns false.
+       * @return number of handles passed to func
+       */
+      virtual std::size_t lookupEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::function<bool(const std::string & handle)> func)
+      {
+        std::size_t n = 0;
+        for(auto & handle : lookup(query))
+        {
+          n++;
+          if(!func(handle))
+          {
+            break;
+          }
+        }
+        return n;
+      }
+
+      /**
+       * Results of several queries, in the order of the queries.
+       * Identical queries are sent only once.
+       */
+      virtual std::vector<std::vector<std::string>> lookupMany(const std::vector<std::vector<std::pair<std::string, std::string>>> & queries)
+      {
+        std::vector<std::vector<std::string>> ret(queries.size());
+        std::map<std::vector<std::pair<std::string, std::string>>, std::size_t> first;
+        for(std::size_t i = 0; i < queries.size(); i++)
+        {
+          auto itr = first.find(queries[i]);
+          if(itr == first.end())
+          {
+            ret[i] = lookup(queries[i]);
+            first[queries[i]] = i;
+          }
+          else
+          {
+            ret[i] = ret[itr->second];
+          }
+        }
+        return ret;
+      }
+
+      /**
+       * Matching handles together with their values, for lookup services
+       * that return the records with the lookup (retrieverecords=true).
+       * @param records pairs of handle and array of handle values,
+       *        the values are null if the service ignored retrieverecords
+       * @return false if this client does not retrieve records
+       */
+      virtual bool lookupRecords(const std::vector<std::pair<std::string, std::string>> & query,
+                                 std::vector<std::pair<std::string, surfsara::ast::Node>> & records)
+      {
+        return false;
+      }
+
+      /**
+       * Call func for each matching handle and its array of values,
+       * until all pages are fetched or func returns false.
+       * @return false if this client does not retrieve records
+       */
+      virtual bool lookupRecordsEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::function<bool(const std::string & handle,
+                                                        const surfsara::ast::Node & values)> func)
+      {
+        return false;
+      }
     };
   }
 }
@@ -21,16 +21,130 @@ limitations under the License.
 #include "i_reverse_lookup_client.h"
 #include <surfsara/handle_result.h>
 #include <surfsara/handle_profile.h>
+#include <surfsara/lru_cache.h>
+#include <surfsara/bloom_filter.h>
+#include <surfsara/path_index.h>
 #include <surfsara/ast.h>
 #include <surfsara/util.h>
+#include <surfsara/parallel.h>
+#include <atomic>
 
 namespace surfsara
 {
   namespace handle
   {
+    /**
+     * Handles of iRODS objects, keyed by path.
+     */
+    using PathCache = surfsara::util::LruCache<std::string, std::string>;
+
+    /**
+     * Expanded lookup values for which the reverse lookup found no handle.
+     */
+    using NegativeCache = surfsara::util::LruCache<std::string, bool>;
+
+    /**
+     * Maps iRODS objects to handles.
+     * Safe to share between threads if the underlying clients are.
+     */
     class IRodsHandleClient
     {
     public:
+      /**
+       * Outcome of one path of createMany
+       */
+      struct CreateResult
+      {
+        std::string path;
+        Result result;
+        // set if the handle has not been created
+        std::string error;
+      };
+
+      /**
+       * Outcome of one handle of moveCollection
+       */
+      struct MoveResult
+      {
+        std::string handle;
+        std::string oldPath;
+        std::string newPath;
+        Result result;
+        // set if the handle has not been moved
+        std::string error;
+      };
+
+      /**
+       * Called after each handle of moveCollection with the number of
+       * handles done and the total. Calls are serialized.
+       */
+      using MoveProgress = std::function<void(const MoveResult & result,
+                                              std::size_t done,
+                                              std::size_t total)>;
+
+      /**
+       * Outcome of one handle of removeCollection
+       */
+      struct RemoveResult
+      {
+        std::string handle;
+        Result result;
+        // the handle did not exist anymore
+        bool missing;
+        // the lookup value of the handle is not below the collection
+        bool skipped;
+        // set if the request failed or the handle has been skipped
+        std::string error;
+
+        RemoveResult() : missing(false), skipped(false) {}
+      };
+
+      struct RemoveSummary
+      {
+        std::size_t deleted;
+        std::size_t missing;
+        std::size_t skipped;
+        std::size_t failed;
+
+        RemoveSummary() : deleted(0), missing(0), skipped(0), failed(0) {}
+      };
+
+      using RemoveProgress = std::function<void(const RemoveResult & result,
+                                                std::size_t done,
+                                                std::size_t total)>;
+
+      struct Statistics
+      {
+        surfsara::util::CacheStatistics pathCache;
+        surfsara::util::CacheStatistics negativeCache;
+        // requests sent to the reverse lookup service
+        std::size_t reverseLookups;
+        // lookups before create answered by the bloom filter
+        std::size_t bloomFilterSkips;
+        // paths resolved by the persistent index
+        std::size_t pathIndexHits;
+      };
+
+      /**
+       * The optional path cache saves the reverse lookup of paths that
+       * have been created, looked up or moved by this client before.
+       * Entries of other clients' changes become stale until their ttl expires.
+       *
+       * The optional negative cache remembers lookup values without handle.
+       * Its ttl should be short, since handles created by other processes
+       * are not seen until the entry expires.
+       *
+       * The optional bloom filter contains the lookup values of all existing
+       * handles. If it rules out a value, the lookup before create is skipped.
+       * A filter rules out nothing until bloom_build has marked it complete.
+       * Afterwards this is only safe if every client that creates handles for
+       * the lookup service updates the same filter file.
+       *
+       * The optional path index persists lookup value -> handle between
+       * processes. It is consulted after the path cache and maintained by
+       * create, move and remove. Handles created or removed by other tools
+       * are not seen until the index is rebuilt.
+       */
       IRodsHandleClient(std::shared_ptr<I_HandleClient> _handleClient,
                         const std::string & _handlePrefix,
                         std::shared_ptr<I_ReverseLookupClient> _reverseLookupClient,
@@ -38,28 +152,82 @@ namespace surfsara
                         bool _do_lookup_before,
                         //const IRodsConfig & _config,
                         const std::string & _lookupKey,
-                        const std::string & _lookupValue) :
+                        const std::string & _lookupValue,
+                        std::shared_ptr<PathCache> _pathCache = nullptr,
+                        std::shared_ptr<NegativeCache> _negativeCache = nullptr,
+                        std::shared_ptr<surfsara::util::BloomFilter> _bloomFilter = nullptr,
+                        std::shared_ptr<surfsara::util::PathIndex> _pathIndex = nullptr) :
         handleClient(_handleClient),
         handlePrefix(_handlePrefix),
         profile(_profile),
         reverseLookupClient(_reverseLookupClient),
         do_lookup_before(_do_lookup_before),
         lookupKey(_lookupKey),
-        lookupValue(_lookupValue)
+        lookupValue(_lookupValue),
+        pathCache(_pathCache),
+        negativeCache(_negativeCache),
+        bloomFilter(_bloomFilter),
+        pathIndex(_pathIndex),
+        reverseLookups(0),
+        bloomFilterSkips(0),
+        pathIndexHits(0)
       {}
 
       inline Result create(const std::string & paths,
                            const std::vector<std::pair<std::string, std::string>> & kvpairs);
 
+      /**
+       * Create the handles of several paths with the same kvpairs.
+       * The lookups before create are sent as one lookupMany, the handles
+       * are created by up to concurrency threads. Paths that fail, or that
+       * occur twice, are reported in the result instead of throwing.
+       * @return one result per path, in the order of paths
+       */
+      inline std::vector<CreateResult> createMany(const std::vector<std::string> & paths,
+                                                  const std::vector<std::pair<std::string, std::string>> & kvpairs,
+                                                  std::size_t concurrency = 1);
+
       inline Result moveHandle(const std::string & handle, const std::string & newPath);
       inline Result move(const std::string & oldPath, const std::string & newPath);
 
+      /**
+       * Move the handles of all objects below a collection.
+       * The handles are found by one wildcard lookup of the lookup value
+       * and rewritten by up to concurrency threads.
+       * @return one result per handle, failures do not stop the other moves
+       */
+      inline std::vector<MoveResult> moveCollection(const std::string & oldPrefix,
+                                                    const std::string & newPrefix,
+                                                    std::size_t concurrency = 1,
+                                                    MoveProgress progress = nullptr);
+
       inline Result removeHandle(const std::string & handle);
       inline Result remove(const std::string & path);
 
+      /**
+       * Remove the handles of all objects below a collection.
+       * The handles are found page by page by a wildcard lookup of the
+       * lookup value and removed by up to concurrency threads, at most
+       * requestsPerSecond requests per second (0: unlimited).
+       * Handles whose lookup value is not below the collection are skipped.
+       * The value is taken from the records of the lookup service or
+       * fetched by a GET of the lookup_key type.
+       * Progress is reported as in moveCollection.
+       */
+      inline RemoveSummary removeCollection(const std::string & prefix,
+                                            std::size_t concurrency = 1,
+                                            double requestsPerSecond = 0,
+                                            RemoveProgress progress = nullptr);
+
       inline Result get(const std::string & path);
       inline Result getHandle(const std::string & handle);
 
+      /**
+       * Get only the entries of the given types
+       */
+      inline Result get(const std::string & path,
+                        const std::vector<std::string> & types);
+
       /**
        * Update a set of indices of a handle
        */
@@ -86,7 +254,82 @@ namespace surfsara
        */
       inline std::string lookupOne(const std::string & path);
 
+      /**
+       * Lookup the handles of several paths with as few round trips
+       * as the reverse lookup client allows.
+       * @return matching handles for each path, in the order of paths
+       */
+      inline std::vector<std::vector<std::string>> lookupMany(const std::vector<std::string> & paths);
+
+      inline Statistics getStatistics() const;
+
     private:
+      /**
+       * Handle of a path, from the path cache or by reverse lookup.
+       * Entries of the path index are always checked against the record.
+       * @param unique throw if more than one handle matches
+       * @param validate check path cache entries as well, before the
+       *        handle is modified or removed
+       */
+      inline std::string resolve(const std::string & path, bool unique, bool validate);
+
+      /**
+       * Handle of a path from the path cache or the path index.
+       * @param indexed true if the handle was taken from the path index,
+       *        which other processes may have changed.
+       */
+      inline bool cachedHandle(const std::string & path, std::string & handle, bool & indexed);
+
+      /**
+       * Check that the lookup_key entry of a record equals the lookup value.
+       */
+      inline bool recordMatches(const Result & obj, const std::string & value) const;
+
+      /**
+       * Path of a lookup value, false if value is not an expansion of lookup_value.
+       */
+      inline bool pathOfValue(const std::string & value, std::string & path) const;
+
+      /**
+       * Record of a path. The record is taken from the reverse lookup
+       * response if the lookup service returns records, otherwise it
+       * is fetched from the handle server.
+       */
+      inline Result fetch(const std::string & path, bool unique, std::string & handle);
+      inline void lookupFailed(const std::string & path, std::size_t found);
+      inline Result moveRecord(const std::string & handle, Result & obj, const std::string & newPath);
+      inline Result setRecord(const std::string & handle,
+                              Result & obj,
+                              const std::vector<std::pair<std::string, std::string>> & kvpairs);
+      inline Result unsetRecord(const std::string & handle,
+                                Result & obj,
+                                const std::vector<std::string> & keys);
+      inline std::vector<std::string> reverseLookup(const std::string & path);
+
+      /**
+       * Update caches, filter and index after the handle of path has been created.
+       */
+      inline void learnCreate(const std::string & path, const std::string & value, const Result & res);
+
+      /**
+       * Update caches, filter and index with the result of a reverse lookup.
+       */
+      inline void learnLookup(const std::string & value, const std::vector<std::string> & handles);
+
+      /**
+       * Evict the path index and path cache entries of a lookup value.
+       */
+      inline void forgetValue(const std::string & value);
+      inline void forgetMissing(const std::string & path);
+
+      /**
+       * Send the entries that differ from the snapshot:
+       * DELETE for removed indices, PUT for added and changed ones.
+       */
+      inline Result updateChanged(const std::string & handle,
+                                  const RecordSnapshot & before,
+                                  const Result & obj);
+
       std::shared_ptr<I_HandleClient> handleClient;
       std::string handlePrefix;
       std::shared_ptr<I_ReverseLookupClient> reverseLookupClient;
@@ -94,6 +337,13 @@ namespace surfsara
       bool do_lookup_before;
       std::string lookupKey;
       std::string lookupValue;
+      std::shared_ptr<PathCache> pathCache;
+      std::shared_ptr<NegativeCache> negativeCache;
+      std::shared_ptr<surfsara::util::BloomFilter> bloomFilter;
+      std::shared_ptr<surfsara::util::PathIndex> pathIndex;
+      std::atomic<std::size_t> reverseLookups;
+      std::atomic<std::size_t> bloomFilterSkips;
+      std::atomic<std::size_t> pathIndexHits;
     };
   } // handle
 }
@@ -110,34 +360,148 @@ namespace surfsara
       using String = surfsara::ast::String;
       using Integer = surfsara::ast::Integer;
       std::map<std::string, std::string> object_repl_map{{"{OBJECT}", path}};
-      if(do_lookup_before)
+      auto value = profile->expand(lookupValue, object_repl_map);
+      if(do_lookup_before && bloomFilter && !bloomFilter->mayContain(value))
+      {
+        bloomFilterSkips++;
+      }
+      else if(do_lookup_before)
       {
-        auto value = profile->expand(lookupValue, object_repl_map);
-        auto lookupResult = reverseLookupClient->lookup({{lookupKey, value}});
+        // not answered from the caches, stale entries must not block a create
+        // nor hide an existing handle
+        forgetMissing(path);
+        auto lookupResult = reverseLookup(path);
         if(!lookupResult.empty())
         {
           throw ValidationError({std::string("Object with ") + lookupKey + "=" + value + " already exists."});
         }
       }
-      return handleClient->create(handlePrefix, profile->create(object_repl_map,
-                                                                kvp));
+      auto res = handleClient->create(handlePrefix, profile->create(object_repl_map,
+                                                                    kvp));
+      learnCreate(path, value, res);
+      return res;
+    }
+
+    inline std::vector<IRodsHandleClient::CreateResult>
+    IRodsHandleClient::createMany(const std::vector<std::string> & paths,
+                                  const std::vector<std::pair<std::string, std::string>> & kvp,
+                                  std::size_t concurrency)
+    {
+      std::vector<CreateResult> ret(paths.size());
+      std::vector<std::string> values(paths.size());
+      std::set<std::string> seen;
+      std::vector<std::size_t> pending;
+      std::vector<std::string> pendingPaths;
+      for(std::size_t i = 0; i < paths.size(); i++)
+      {
+        ret[i].path = paths[i];
+        values[i] = profile->expand(lookupValue, {{"{OBJECT}", paths[i]}});
+        if(!seen.insert(values[i]).second)
+        {
+          ret[i].error = std::string("Object with ") + lookupKey + "=" + values[i] + " occurs more than once.";
+        }
+        else if(do_lookup_before && bloomFilter && !bloomFilter->mayContain(values[i]))
+        {
+          bloomFilterSkips++;
+        }
+        else if(do_lookup_before)
+        {
+          forgetMissing(paths[i]);
+          pending.push_back(i);
+          pendingPaths.push_back(paths[i]);
+        }
+      }
+      if(!pendingPaths.empty())
+      {
+        auto found = lookupMany(pendingPaths);
+        for(std::size_t j = 0; j < pending.size(); j++)
+        {
+          if(!found[j].empty())
+          {
+            std::size_t i = pending[j];
+            ret[i].error = std::string("Object with ") + lookupKey + "=" + values[i] + " already exists.";
+          }
+        }
+      }
+      // the profile is expanded up front, only the requests run concurrently
+      std::vector<surfsara::ast::Node> records(paths.size());
+      for(std::size_t i = 0; i < paths.size(); i++)
+      {
+        if(ret[i].error.empty())
+        {
+          try
+          {
+            records[i] = profile->create({{"{OBJECT}", paths[i]}}, kvp);
+          }
+          catch(const std::exception & ex)
+          {
+            ret[i].error = ex.what();
+          }
+        }
+      }
+      surfsara::util::parallelFor(paths.size(), concurrency, [this, &ret, &values, &records](std::size_t i) {
+          if(!ret[i].error.empty())
+          {
+            return;
+          }
+          try
+          {
+            ret[i].result = handleClient->create(handlePrefix, records[i]);
+            learnCreate(ret[i].path, values[i], ret[i].result);
+          }
+          catch(const std::exception & ex)
+          {
+            ret[i].error = ex.what();
+          }
+        });
+      return ret;
+    }
+
+    inline void IRodsHandleClient::learnCreate(const std::string & path, const std::string & value, const Result & res)
+    {
+      forgetMissing(path);
+      if(bloomFilter && res.success)
+      {
+        bloomFilter->add(value);
+      }
+      if(pathCache && res.success && !res.handle.empty())
+      {
+        pathCache->put(path, res.handle);
+      }
+      if(pathIndex && res.success && !res.handle.empty())
+      {
+        pathIndex->put(value, res.handle);
+      }
     }
 
     inline Result IRodsHandleClient::moveHandle(const std::string & handle, const std::string & newPath)
     {
       auto obj = handleClient->get(handle);
+      return moveRecord(handle, obj, newPath);
+    }
+
+    inline Result IRodsHandleClient::moveRecord(const std::string & handle, Result & obj, const std::string & newPath)
+    {
+      if(obj.success)
+      {
+        forgetValue(extractValueByType(obj.data, lookupKey));
+      }
+      forgetMissing(newPath);
+      if(bloomFilter)
+      {
+        // added before the update, a failed move only costs a false positive
+        bloomFilter->add(profile->expand(lookupValue, {{"{OBJECT}", newPath}}));
+      }
       if(obj.success)
       {
-        auto removedIndices = profile->update(obj.data, {{"{OBJECT}", newPath}});
-        if(!removedIndices.empty())
+        auto before = snapshotRecord(obj.data);
+        profile->update(obj.data, {{"{OBJECT}", newPath}});
+        auto res = updateChanged(handle, before, obj);
+        if(pathIndex && res.success)
         {
-          auto res = handleClient->removeIndices(handle, removedIndices);
-          if(!res.success)
-          {
-            throw ValidationError({std::string("Failed to remove unused keys")});
-          }
+          pathIndex->put(profile->expand(lookupValue, {{"{OBJECT}", newPath}}), handle);
         }
-        return handleClient->update(handle, obj.data);
+        return res;
       }
       else
       {
@@ -147,17 +511,227 @@ namespace surfsara
 
     inline Result IRodsHandleClient::move(const std::string & oldPath, const std::string & newPath)
     {
-      return moveHandle(lookupOne(oldPath), newPath);
+      std::string handle;
+      auto obj = fetch(oldPath, true, handle);
+      auto res = moveRecord(handle, obj, newPath);
+      if(pathCache && res.success)
+      {
+        pathCache->put(newPath, handle);
+      }
+      return res;
+    }
+
+    inline std::vector<IRodsHandleClient::MoveResult>
+    IRodsHandleClient::moveCollection(const std::string & _oldPrefix,
+                                      const std::string & _newPrefix,
+                                      std::size_t concurrency,
+                                      MoveProgress progress)
+    {
+      std::string oldPrefix(_oldPrefix);
+      std::string newPrefix(_newPrefix);
+      while(oldPrefix.size() > 1 && oldPrefix.back() == '/')
+      {
+        oldPrefix.pop_back();
+      }
+      while(newPrefix.size() > 1 && newPrefix.back() == '/')
+      {
+        newPrefix.pop_back();
+      }
+      // lookup value = before + object + after
+      std::size_t pos = lookupValue.find("{OBJECT}");
+      if(pos == std::string::npos)
+      {
+        throw ValidationError({std::string("lookup value ") + lookupValue + " does not contain {OBJECT}"});
+      }
+      std::string before = profile->expand(lookupValue.substr(0, pos));
+      std::string after = profile->expand(lookupValue.substr(pos + 8));
+      std::vector<std::string> handles;
+      reverseLookups++;
+      // wildcards in the names must match themselves
+      reverseLookupClient->lookupEach({{lookupKey, (surfsara::util::escapeGlob(before + oldPrefix + "/") + "*" +
+                                                    surfsara::util::escapeGlob(after))}},
+                                      [&handles](const std::string & handle) {
+                                        handles.push_back(handle);
+                                        return true;
+                                      });
+      std::vector<MoveResult> ret(handles.size());
+      std::mutex mutex;
+      std::size_t done = 0;
+      surfsara::util::parallelFor(handles.size(), concurrency, [&](std::size_t i) {
+          MoveResult & r(ret[i]);
+          r.handle = handles[i];
+          try
+          {
+            auto obj = handleClient->get(r.handle);
+            if(!obj.success)
+            {
+              throw ValidationError({std::string("Failed to retriev handle / decode ") + r.handle});
+            }
+            std::string value = extractValueByType(obj.data, lookupKey);
+            pathOfValue(value, r.oldPath);
+            // the value may have changed since the lookup
+            if(r.oldPath.compare(0, oldPrefix.size() + 1, oldPrefix + "/") != 0)
+            {
+              r.error = lookupKey + "=" + value + " is not below " + oldPrefix;
+            }
+            else
+            {
+              r.newPath = newPrefix + r.oldPath.substr(oldPrefix.size());
+              r.result = moveRecord(r.handle, obj, r.newPath);
+              if(pathCache && r.result.success)
+              {
+                pathCache->put(r.newPath, r.handle);
+              }
+            }
+          }
+          catch(const std::exception & ex)
+          {
+            r.error = ex.what();
+          }
+          if(progress)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            progress(r, ++done, handles.size());
+          }
+        });
+      return ret;
     }
 
     inline Result IRodsHandleClient::removeHandle(const std::string & handle)
     {
+      if(pathCache || pathIndex)
+      {
+        // the entries are keyed by path, which is taken from the record
+        auto obj = handleClient->get(handle, std::vector<std::string>{lookupKey});
+        if(obj.success)
+        {
+          forgetValue(extractValueByType(obj.data, lookupKey));
+        }
+      }
       return handleClient->remove(handle);
     }
 
+    inline IRodsHandleClient::RemoveSummary IRodsHandleClient::removeCollection(const std::string & _prefix,
+                                                                                 std::size_t concurrency,
+                                                                                 double requestsPerSecond,
+                                                                                 RemoveProgress progress)
+    {
+      std::string prefix(_prefix);
+      while(prefix.size() > 1 && prefix.back() == '/')
+      {
+        prefix.pop_back();
+      }
+      std::size_t pos = lookupValue.find("{OBJECT}");
+      if(pos == std::string::npos)
+      {
+        throw ValidationError({std::string("lookup value ") + lookupValue + " does not contain {OBJECT}"});
+      }
+      // wildcards in the names must match themselves
+      std::string pattern = (surfsara::util::escapeGlob(profile->expand(lookupValue.substr(0, pos)) + prefix + "/") + "*" +
+                             surfsara::util::escapeGlob(profile->expand(lookupValue.substr(pos + 8))));
+      // collected before the first removal, which would shift the pages,
+      // the values are taken from the records if the service returns them
+      std::vector<std::string> handles;
+      std::vector<std::string> values;
+      reverseLookups++;
+      bool withValues = reverseLookupClient->lookupRecordsEach({{lookupKey, pattern}},
+                                                               [this, &handles, &values](const std::string & handle,
+                                                                                         const surfsara::ast::Node & record) {
+                                                                 handles.push_back(handle);
+                                                                 values.push_back(extractValueByType(surfsara::ast::Object{{"values", record}},
+                                                                                                     lookupKey));
+                                                                 return true;
+                                                               });
+      if(!withValues)
+      {
+        reverseLookupClient->lookupEach({{lookupKey, pattern}},
+                                        [&handles](const std::string & handle) {
+                                          handles.push_back(handle);
+                                          return true;
+                                        });
+      }
+      RemoveSummary summary;
+      std::size_t done = 0;
+      std::mutex mutex;
+      surfsara::util::RateLimiter limiter(requestsPerSecond, concurrency ? concurrency : 1);
+      surfsara::util::parallelFor(handles.size(), concurrency, [&](std::size_t i) {
+          RemoveResult r;
+          r.handle = handles[i];
+          try
+          {
+            std::string value;
+            if(withValues)
+            {
+              value = values[i];
+            }
+            else
+            {
+              limiter.acquire();
+              r.result = handleClient->get(r.handle, std::vector<std::string>{lookupKey});
+              r.missing = (!r.result.success && r.result.curlResult.httpCode == 404);
+              value = (r.result.success ? extractValueByType(r.result.data, lookupKey) : std::string());
+            }
+            // the value may have changed since the lookup
+            std::string path;
+            if(withValues || r.result.success)
+            {
+              if(!pathOfValue(value, path) || path.compare(0, prefix.size() + 1, prefix + "/") != 0)
+              {
+                r.skipped = true;
+                r.result = Result();
+                r.error = lookupKey + "=" + value + " is not below " + prefix;
+              }
+              else
+              {
+                forgetValue(value);
+                limiter.acquire();
+                r.result = handleClient->remove(r.handle);
+                r.missing = (!r.result.success && r.result.curlResult.httpCode == 404);
+              }
+            }
+            else if(!r.missing)
+            {
+              r.error = std::string("could not get ") + lookupKey + ": http code " +
+                std::to_string(r.result.curlResult.httpCode) + " (" +
+                surfsara::curl::httpCode2string(r.result.curlResult.httpCode) + "), handle code " +
+                std::to_string(r.result.handleCode) + " (" + responseCode2string(r.result.handleCode) + ")";
+            }
+          }
+          catch(const std::exception & ex)
+          {
+            r.error = ex.what();
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          if(r.result.success)
+          {
+            summary.deleted++;
+          }
+          else if(r.missing)
+          {
+            summary.missing++;
+          }
+          else if(r.skipped)
+          {
+            summary.skipped++;
+          }
+          else
+          {
+            summary.failed++;
+          }
+          if(progress)
+          {
+            progress(r, ++done, handles.size());
+          }
+        });
+      return summary;
+    }
+
     inline Result IRodsHandleClient::remove(const std::string & path)
     {
-      return removeHandle(lookupOne(path));
+      // another process may have moved the handle of a cached path
+      auto handle = resolve(path, true, true);
+      forgetValue(profile->expand(lookupValue, {{"{OBJECT}", path}}));
+      return handleClient->remove(handle);
     }
 
     inline Result IRodsHandleClient::getHandle(const std::string & handle)
@@ -167,27 +741,32 @@ namespace surfsara
 
     inline Result IRodsHandleClient::get(const std::string & path)
     {
-      auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
-      auto lookupResult = reverseLookupClient->lookup({{lookupKey, value}});
-      if(lookupResult.empty())
-      {
-        throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value});
-      }
-      else
-      {
-        std::string handle(lookupResult[0]);
-        return handleClient->get(handle);
-      }
+      std::string handle;
+      return fetch(path, false, handle);
+    }
+
+    inline Result IRodsHandleClient::get(const std::string & path,
+                                         const std::vector<std::string> & types)
+    {
+      return handleClient->get(resolve(path, false, false), types);
     }
 
     inline Result IRodsHandleClient::setHandle(const std::string & handle,
                                                const std::vector<std::pair<std::string, std::string>> & kvp)
     {
       auto obj = handleClient->get(handle);
+      return setRecord(handle, obj, kvp);
+    }
+
+    inline Result IRodsHandleClient::setRecord(const std::string & handle,
+                                               Result & obj,
+                                               const std::vector<std::pair<std::string, std::string>> & kvp)
+    {
       if(obj.success)
       {
+        auto before = snapshotRecord(obj.data);
         profile->setIndices(obj.data, kvp);
-        return handleClient->update(handle, obj.data);
+        return updateChanged(handle, before, obj);
       }
       else
       {
@@ -198,25 +777,22 @@ namespace surfsara
     inline Result IRodsHandleClient::set(const std::string & path,
                                          const std::vector<std::pair<std::string, std::string>> & kvp)
     {
-      using Integer = surfsara::ast::Integer;
-      using Undefined = surfsara::ast::Undefined;
-      using String = surfsara::ast::String;
-      auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
-      auto lookupResult = reverseLookupClient->lookup({{lookupKey, value}});
-      if(lookupResult.empty())
-      {
-        throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value});
-      }
-      else
-      {
-        return setHandle(lookupResult[0], kvp);
-      }
+      std::string handle;
+      auto obj = fetch(path, false, handle);
+      return setRecord(handle, obj, kvp);
     }
 
     inline Result IRodsHandleClient::unsetHandle(const std::string & handle,
                                                  const std::vector<std::string> & keys)
     {
-      auto obj = handleClient->get(handle); 
+      auto obj = handleClient->get(handle);
+      return unsetRecord(handle, obj, keys);
+    }
+
+    inline Result IRodsHandleClient::unsetRecord(const std::string & handle,
+                                                 Result & obj,
+                                                 const std::vector<std::string> & keys)
+    {
       if(obj.success)
       {
         std::vector<int> removeIndices = profile->unsetIndices(obj.data, keys);
@@ -231,42 +807,310 @@ namespace surfsara
     inline Result IRodsHandleClient::unset(const std::string & path,
                                            const std::vector<std::string> & keys)
     {
-      using Integer = surfsara::ast::Integer;
-      using Undefined = surfsara::ast::Undefined;
+      std::string handle;
+      auto obj = fetch(path, false, handle);
+      return unsetRecord(handle, obj, keys);
+    }
+
+    inline std::vector<std::string> IRodsHandleClient::lookup(const std::string & path)
+    {
+      auto lookupResult = reverseLookup(path);
+      if(pathCache && lookupResult.size() == 1)
+      {
+        pathCache->put(path, lookupResult[0]);
+      }
+      return lookupResult;
+    }
+
+    inline std::string IRodsHandleClient::lookupOne(const std::string & path)
+    {
+      return resolve(path, true, false);
+    }
+
+    inline std::vector<std::vector<std::string>> IRodsHandleClient::lookupMany(const std::vector<std::string> & paths)
+    {
+      std::vector<std::vector<std::string>> ret(paths.size());
+      std::vector<std::string> values(paths.size());
+      std::vector<std::size_t> pending;
+      std::vector<std::vector<std::pair<std::string, std::string>>> queries;
+      for(std::size_t i = 0; i < paths.size(); i++)
+      {
+        values[i] = profile->expand(lookupValue, {{"{OBJECT}", paths[i]}});
+        bool missing;
+        if(!negativeCache || !negativeCache->get(values[i], missing))
+        {
+          pending.push_back(i);
+          queries.push_back({{lookupKey, values[i]}});
+        }
+      }
+      if(queries.empty())
+      {
+        return ret;
+      }
+      reverseLookups += queries.size();
+      auto results = reverseLookupClient->lookupMany(queries);
+      for(std::size_t j = 0; j < pending.size(); j++)
+      {
+        std::size_t i = pending[j];
+        ret[i].swap(results[j]);
+        learnLookup(values[i], ret[i]);
+        if(pathCache && ret[i].size() == 1)
+        {
+          pathCache->put(paths[i], ret[i][0]);
+        }
+      }
+      return ret;
+    }
+
+    inline IRodsHandleClient::Statistics IRodsHandleClient::getStatistics() const
+    {
+      Statistics ret;
+      if(pathCache)
+      {
+        ret.pathCache = pathCache->getStatistics();
+      }
+      if(negativeCache)
+      {
+        ret.negativeCache = negativeCache->getStatistics();
+      }
+      ret.reverseLookups = reverseLookups;
+      ret.bloomFilterSkips = bloomFilterSkips;
+      ret.pathIndexHits = pathIndexHits;
+      return ret;
+    }
+
+    inline std::string IRodsHandleClient::resolve(const std::string & path, bool unique, bool validate)
+    {
+      std::string handle;
+      bool indexed;
+      if(cachedHandle(path, handle, indexed))
+      {
+        if(!indexed && !validate)
+        {
+          return handle;
+        }
+        // the entry is stale if another process has moved or removed the handle
+        auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
+        if(recordMatches(handleClient->get(handle, std::vector<std::string>{lookupKey}), value))
+        {
+          if(indexed && pathCache)
+          {
+            pathCache->put(path, handle);
+          }
+          return handle;
+        }
+        forgetValue(value);
+      }
+      auto lookupResult = reverseLookup(path);
+      if(lookupResult.size() == 1)
+      {
+        if(pathCache)
+        {
+          pathCache->put(path, lookupResult[0]);
+        }
+        return lookupResult[0];
+      }
+      else if(lookupResult.size() == 0 || unique)
+      {
+        lookupFailed(path, lookupResult.size());
+      }
+      return lookupResult[0];
+    }
+
+    inline bool IRodsHandleClient::cachedHandle(const std::string & path, std::string & handle, bool & indexed)
+    {
+      indexed = false;
+      if(pathCache && pathCache->get(path, handle))
+      {
+        return true;
+      }
+      if(pathIndex && pathIndex->get(profile->expand(lookupValue, {{"{OBJECT}", path}}), handle))
+      {
+        // the index keeps one handle per value, uniqueness is not checked
+        pathIndexHits++;
+        indexed = true;
+        return true;
+      }
+      return false;
+    }
+
+    inline bool IRodsHandleClient::recordMatches(const Result & obj, const std::string & value) const
+    {
+      return obj.success && extractValueByType(obj.data, lookupKey) == value;
+    }
+
+    inline bool IRodsHandleClient::pathOfValue(const std::string & value, std::string & path) const
+    {
+      // lookup value = before + object + after
+      std::size_t pos = lookupValue.find("{OBJECT}");
+      if(pos == std::string::npos)
+      {
+        return false;
+      }
+      std::string before = profile->expand(lookupValue.substr(0, pos));
+      std::string after = profile->expand(lookupValue.substr(pos + 8));
+      if(value.size() < before.size() + after.size() ||
+         value.compare(0, before.size(), before) != 0 ||
+         value.compare(value.size() - after.size(), after.size(), after) != 0)
+      {
+        return false;
+      }
+      path = value.substr(before.size(), value.size() - before.size() - after.size());
+      return true;
+    }
+
+    inline void IRodsHandleClient::lookupFailed(const std::string & path, std::size_t found)
+    {
       auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
-      auto lookupResult = reverseLookupClient->lookup({{lookupKey, value}});
-      if(lookupResult.empty())
+      if(found == 0)
       {
         throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value});
       }
       else
       {
-        return unsetHandle(lookupResult[0], keys);
+        throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value + " not unique, found " + std::to_string(found) + " matching entries"});
       }
     }
 
-    inline std::vector<std::string> IRodsHandleClient::lookup(const std::string & path)
+    inline Result IRodsHandleClient::fetch(const std::string & path, bool unique, std::string & handle)
     {
+      using Object = surfsara::ast::Object;
+      using String = surfsara::ast::String;
+      using Integer = surfsara::ast::Integer;
       auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
-      return reverseLookupClient->lookup({{lookupKey, value}});
+      bool indexed;
+      if(cachedHandle(path, handle, indexed))
+      {
+        auto obj = handleClient->get(handle);
+        // the entry is stale if the handle has been moved or removed since
+        if(recordMatches(obj, value))
+        {
+          if(indexed && pathCache)
+          {
+            pathCache->put(path, handle);
+          }
+          return obj;
+        }
+        forgetValue(value);
+      }
+      bool missing;
+      std::vector<std::pair<std::string, surfsara::ast::Node>> records;
+      if((!negativeCache || !negativeCache->get(value, missing)) &&
+         reverseLookupClient->lookupRecords({{lookupKey, value}}, records))
+      {
+        reverseLookups++;
+        std::vector<std::string> handles;
+        for(auto & record : records)
+        {
+          handles.push_back(record.first);
+        }
+        learnLookup(value, handles);
+        if(records.size() == 0 || (unique && records.size() > 1))
+        {
+          lookupFailed(path, records.size());
+        }
+        handle = records[0].first;
+        if(pathCache && records.size() == 1)
+        {
+          pathCache->put(path, handle);
+        }
+        if(records[0].second.isA<surfsara::ast::Null>())
+        {
+          // the lookup service ignored retrieverecords
+          return handleClient->get(handle);
+        }
+        // same layout as the response of the handle server
+        Object obj;
+        obj.set("responseCode", Integer(1));
+        obj.set("handle", String(handle));
+        obj.set("values", records[0].second);
+        Result res;
+        res.success = true;
+        res.handleCode = 1;
+        res.handle = handle;
+        res.data = surfsara::ast::Node(obj);
+        // writes that are still queued by the handle client
+        handleClient->overlay(handle, res);
+        return res;
+      }
+      handle = resolve(path, unique, false);
+      return handleClient->get(handle);
     }
 
-    inline std::string IRodsHandleClient::lookupOne(const std::string & path)
+    inline std::vector<std::string> IRodsHandleClient::reverseLookup(const std::string & path)
     {
       auto value = profile->expand(lookupValue, {{"{OBJECT}", path}});
-      auto lookupResult = reverseLookupClient->lookup({{lookupKey, value}});
-      if(lookupResult.size() == 1)
+      bool missing;
+      if(negativeCache && negativeCache->get(value, missing))
       {
-        return lookupResult[0];
+        return std::vector<std::string>();
       }
-      else if(lookupResult.size() == 0)
+      reverseLookups++;
+      auto ret = reverseLookupClient->lookup({{lookupKey, value}});
+      learnLookup(value, ret);
+      return ret;
+    }
+
+    inline void IRodsHandleClient::learnLookup(const std::string & value, const std::vector<std::string> & handles)
+    {
+      if(negativeCache && handles.empty())
       {
-        throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value});
+        negativeCache->put(value, true);
       }
-      else
+      else if(bloomFilter && !handles.empty())
+      {
+        bloomFilter->add(value);
+      }
+      if(pathIndex && handles.size() == 1)
+      {
+        pathIndex->put(value, handles[0]);
+      }
+      else if(pathIndex && handles.empty())
+      {
+        pathIndex->erase(value);
+      }
+    }
+
+    inline void IRodsHandleClient::forgetMissing(const std::string & path)
+    {
+      if(negativeCache)
+      {
+        negativeCache->erase(profile->expand(lookupValue, {{"{OBJECT}", path}}));
+      }
+    }
+
+    inline void IRodsHandleClient::forgetValue(const std::string & value)
+    {
+      std::string path;
+      if(pathCache && pathOfValue(value, path))
+      {
+        pathCache->erase(path);
+      }
+      if(pathIndex && !value.empty())
+      {
+        pathIndex->erase(value);
+      }
+    }
+
+    inline Result IRodsHandleClient::updateChanged(const std::string & handle,
+                                                   const RecordSnapshot & before,
+                                                   const Result & obj)
+    {
+      RecordDiff diff = diffRecords(before, obj.data);
+      Result res(obj);
+      if(!diff.removed.empty())
+      {
+        res = handleClient->removeIndices(handle, diff.removed);
+        if(!res.success)
+        {
+          throw ValidationError({std::string("Failed to remove unused keys")});
+        }
+      }
+      if(diff.hasUpdate())
       {
-        throw ValidationError({std::string("Could not find PID for ") + lookupKey + "=" + value + " not unique, found " + std::to_string(lookupResult.size()) + " matching entries"});
+        res = handleClient->update(handle, diff.update);
       }
+      return res;
     }
   }
 }
@@ -0,0 +1,598 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <set>
+#include <map>
+#include <functional>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    /**
+     * Extracts members of a JSON object without building a syntax tree.
+     * Nested values are skipped, not validated.
+     */
+    class JsonScanner
+    {
+    public:
+      JsonScanner(const std::string & _json) : json(_json), pos(0) {}
+
+      /**
+       * Copy the raw JSON text of the requested top level members to raw.
+       * @return false if the document is not a JSON object
+       */
+      inline bool scanObject(const std::set<std::string> & keys,
+                             std::map<std::string, std::string> & raw);
+
+      static inline bool decodeString(const std::string & raw, std::string & value);
+      static inline bool decodeInteger(const std::string & raw, long & value);
+
+    private:
+      inline void skipWhitespace();
+      inline bool readString(std::string & value);
+      inline bool skipString();
+      inline bool skipValue();
+
+      const std::string & json;
+      std::size_t pos;
+    };
+
+    /**
+     * Incremental parser of a JSON array of strings.
+     *
+     * The document is fed in chunks as they arrive and each element is
+     * passed to the callback as soon as it is complete. Only the element
+     * that is currently parsed is buffered, the string passed to the
+     * callback is reused for the next element.
+     */
+    class JsonStringArrayParser
+    {
+    public:
+      /**
+       * @param _func called for each element, return false to stop parsing
+       */
+      JsonStringArrayParser(std::function<bool(const std::string & value)> _func)
+        : func(_func), state(State::BeforeArray), hexDigits(0), codePoint(0), highSurrogate(0), count(0) {}
+
+      /**
+       * @return false on a syntax error or if the callback stopped parsing
+       */
+      inline bool feed(const char * data, std::size_t size);
+
+      /**
+       * @return true if a complete array has been parsed
+       */
+      inline bool finish();
+
+      inline std::size_t getCount() const;
+
+      /**
+       * Reason of the last failure, empty if the callback stopped parsing
+       */
+      inline const std::string & getError() const;
+
+    private:
+      enum class State
+      {
+        BeforeArray,
+        BeforeFirstValue,
+        BeforeValue,
+        InString,
+        InEscape,
+        InUnicode,
+        AfterValue,
+        Done,
+        Failed
+      };
+
+      inline bool fail(const std::string & message);
+      inline void flushSurrogate();
+
+      std::function<bool(const std::string & value)> func;
+      State state;
+      std::string current;
+      std::string error;
+      int hexDigits;
+      unsigned long codePoint;
+      unsigned long highSurrogate;
+      std::size_t count;
+    };
+
+    namespace details
+    {
+      inline void appendUtf8(std::string & str, unsigned long cp);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <cstdlib>
+#include <cerrno>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    inline bool JsonScanner::scanObject(const std::set<std::string> & keys,
+                                        std::map<std::string, std::string> & raw)
+    {
+      skipWhitespace();
+      if(pos >= json.size() || json[pos] != '{')
+      {
+        return false;
+      }
+      pos++;
+      skipWhitespace();
+      if(pos < json.size() && json[pos] == '}')
+      {
+        pos++;
+      }
+      else
+      {
+        while(true)
+        {
+          std::string key;
+          skipWhitespace();
+          if(!readString(key))
+          {
+            return false;
+          }
+          skipWhitespace();
+          if(pos >= json.size() || json[pos] != ':')
+          {
+            return false;
+          }
+          pos++;
+          skipWhitespace();
+          std::size_t begin = pos;
+          if(!skipValue())
+          {
+            return false;
+          }
+          if(keys.find(key) != keys.end())
+          {
+            raw[key] = json.substr(begin, pos - begin);
+          }
+          skipWhitespace();
+          if(pos >= json.size())
+          {
+            return false;
+          }
+          if(json[pos] == ',')
+          {
+            pos++;
+          }
+          else if(json[pos] == '}')
+          {
+            pos++;
+            break;
+          }
+          else
+          {
+            return false;
+          }
+        }
+      }
+      skipWhitespace();
+      return pos == json.size();
+    }
+
+    inline bool JsonScanner::decodeString(const std::string & raw, std::string & value)
+    {
+      JsonScanner scanner(raw);
+      value.clear();
+      return scanner.readString(value) && scanner.pos == raw.size();
+    }
+
+    inline bool JsonScanner::decodeInteger(const std::string & raw, long & value)
+    {
+      if(raw.empty() || raw.find_first_not_of("-0123456789") != std::string::npos)
+      {
+        return false;
+      }
+      char * end = nullptr;
+      errno = 0;
+      value = std::strtol(raw.c_str(), &end, 10);
+      return errno == 0 && end == raw.c_str() + raw.size();
+    }
+
+    inline void JsonScanner::skipWhitespace()
+    {
+      while(pos < json.size() &&
+            (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r'))
+      {
+        pos++;
+      }
+    }
+
+    inline bool JsonScanner::readString(std::string & value)
+    {
+      if(pos >= json.size() || json[pos] != '"')
+      {
+        return false;
+      }
+      pos++;
+      while(pos < json.size())
+      {
+        char c = json[pos++];
+        if(c == '"')
+        {
+          return true;
+        }
+        else if(c != '\\')
+        {
+          value.push_back(c);
+          continue;
+        }
+        if(pos >= json.size())
+        {
+          return false;
+        }
+        c = json[pos++];
+        switch(c)
+        {
+        case '"':  value.push_back('"'); break;
+        case '\\': value.push_back('\\'); break;
+        case '/':  value.push_back('/'); break;
+        case 'b':  value.push_back('\b'); break;
+        case 'f':  value.push_back('\f'); break;
+        case 'n':  value.push_back('\n'); break;
+        case 'r':  value.push_back('\r'); break;
+        case 't':  value.push_back('\t'); break;
+        case 'u':
+          {
+            if(pos + 4 > json.size())
+            {
+              return false;
+            }
+            std::string hex = json.substr(pos, 4);
+            if(hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+            {
+              return false;
+            }
+            unsigned long cp = std::strtoul(hex.c_str(), nullptr, 16);
+            pos += 4;
+            if(cp >= 0xd800 && cp < 0xdc00 &&
+               pos + 6 <= json.size() && json[pos] == '\\' && json[pos + 1] == 'u')
+            {
+              // surrogate pair
+              std::string low = json.substr(pos + 2, 4);
+              if(low.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos)
+              {
+                unsigned long lcp = std::strtoul(low.c_str(), nullptr, 16);
+                if(lcp >= 0xdc00 && lcp < 0xe000)
+                {
+                  cp = 0x10000 + ((cp - 0xd800) << 10) + (lcp - 0xdc00);
+                  pos += 6;
+                }
+              }
+            }
+            details::appendUtf8(value, cp);
+            break;
+          }
+        default:
+          return false;
+        }
+      }
+      return false;
+    }
+
+    inline bool JsonScanner::skipString()
+    {
+      if(pos >= json.size() || json[pos] != '"')
+      {
+        return false;
+      }
+      pos++;
+      while(pos < json.size())
+      {
+        char c = json[pos++];
+        if(c == '"')
+        {
+          return true;
+        }
+        else if(c == '\\')
+        {
+          pos++;
+        }
+      }
+      return false;
+    }
+
+    inline bool JsonScanner::skipValue()
+    {
+      if(pos >= json.size())
+      {
+        return false;
+      }
+      char c = json[pos];
+      if(c == '"')
+      {
+        return skipString();
+      }
+      else if(c == '{' || c == '[')
+      {
+        std::size_t depth = 0;
+        while(pos < json.size())
+        {
+          c = json[pos];
+          if(c == '"')
+          {
+            if(!skipString())
+            {
+              return false;
+            }
+            continue;
+          }
+          pos++;
+          if(c == '{' || c == '[')
+          {
+            depth++;
+          }
+          else if(c == '}' || c == ']')
+          {
+            depth--;
+            if(depth == 0)
+            {
+              return true;
+            }
+          }
+        }
+        return false;
+      }
+      else
+      {
+        // number, true, false or null
+        std::size_t begin = pos;
+        while(pos < json.size() &&
+              json[pos] != ',' && json[pos] != '}' && json[pos] != ']' &&
+              json[pos] != ' ' && json[pos] != '\t' && json[pos] != '\n' && json[pos] != '\r')
+        {
+          pos++;
+        }
+        return pos > begin;
+      }
+    }
+
+    inline void details::appendUtf8(std::string & str, unsigned long cp)
+    {
+      if(cp < 0x80)
+      {
+        str.push_back(static_cast<char>(cp));
+      }
+      else if(cp < 0x800)
+      {
+        str.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+      }
+      else if(cp < 0x10000)
+      {
+        str.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+      }
+      else
+      {
+        str.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+        str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+      }
+    }
+
+    inline bool JsonStringArrayParser::feed(const char * data, std::size_t size)
+    {
+      if(state == State::Failed)
+      {
+        return false;
+      }
+      for(std::size_t i = 0; i < size; i++)
+      {
+        char c = data[i];
+        switch(state)
+        {
+        case State::InString:
+          if(c == '"')
+          {
+            flushSurrogate();
+            state = State::AfterValue;
+            count++;
+            if(!func(current))
+            {
+              state = State::Failed;
+              return false;
+            }
+            current.clear();
+          }
+          else if(c == '\\')
+          {
+            state = State::InEscape;
+          }
+          else
+          {
+            flushSurrogate();
+            current.push_back(c);
+          }
+          break;
+
+        case State::InEscape:
+          state = State::InString;
+          if(c == 'u')
+          {
+            state = State::InUnicode;
+            hexDigits = 0;
+            codePoint = 0;
+            break;
+          }
+          flushSurrogate();
+          switch(c)
+          {
+          case '"':  current.push_back('"'); break;
+          case '\\': current.push_back('\\'); break;
+          case '/':  current.push_back('/'); break;
+          case 'b':  current.push_back('\b'); break;
+          case 'f':  current.push_back('\f'); break;
+          case 'n':  current.push_back('\n'); break;
+          case 'r':  current.push_back('\r'); break;
+          case 't':  current.push_back('\t'); break;
+          default:
+            return fail("invalid escape sequence");
+          }
+          break;
+
+        case State::InUnicode:
+          if(c >= '0' && c <= '9')
+          {
+            codePoint = (codePoint << 4) | (c - '0');
+          }
+          else if(c >= 'a' && c <= 'f')
+          {
+            codePoint = (codePoint << 4) | (c - 'a' + 10);
+          }
+          else if(c >= 'A' && c <= 'F')
+          {
+            codePoint = (codePoint << 4) | (c - 'A' + 10);
+          }
+          else
+          {
+            return fail("invalid unicode escape sequence");
+          }
+          if(++hexDigits == 4)
+          {
+            state = State::InString;
+            if(highSurrogate && codePoint >= 0xdc00 && codePoint < 0xe000)
+            {
+              details::appendUtf8(current, 0x10000 + ((highSurrogate - 0xd800) << 10) + (codePoint - 0xdc00));
+              highSurrogate = 0;
+            }
+            else
+            {
+              flushSurrogate();
+              if(codePoint >= 0xd800 && codePoint < 0xdc00)
+              {
+                // wait for the low surrogate
+                highSurrogate = codePoint;
+              }
+              else
+              {
+                details::appendUtf8(current, codePoint);
+              }
+            }
+          }
+          break;
+
+        case State::Done:
+          if(c != ' ' && c != '\t' && c != '\n' && c != '\r')
+          {
+            return fail("unexpected data after array");
+          }
+          break;
+
+        default:
+          if(c == ' ' || c == '\t' || c == '\n' || c == '\r')
+          {
+            break;
+          }
+          if(state == State::BeforeArray)
+          {
+            if(c != '[')
+            {
+              return fail("did not return an array");
+            }
+            state = State::BeforeFirstValue;
+          }
+          else if(state == State::AfterValue)
+          {
+            if(c == ',')
+            {
+              state = State::BeforeValue;
+            }
+            else if(c == ']')
+            {
+              state = State::Done;
+            }
+            else
+            {
+              return fail("expected , or ] after array element");
+            }
+          }
+          else if(c == ']' && state == State::BeforeFirstValue)
+          {
+            state = State::Done;
+          }
+          else if(c == '"')
+          {
+            state = State::InString;
+          }
+          else
+          {
+            return fail("element is not a String");
+          }
+          break;
+        }
+      }
+      return true;
+    }
+
+    inline bool JsonStringArrayParser::finish()
+    {
+      if(state == State::Done)
+      {
+        return true;
+      }
+      else if(state != State::Failed)
+      {
+        fail("incomplete array");
+      }
+      return false;
+    }
+
+    inline std::size_t JsonStringArrayParser::getCount() const
+    {
+      return count;
+    }
+
+    inline const std::string & JsonStringArrayParser::getError() const
+    {
+      return error;
+    }
+
+    inline bool JsonStringArrayParser::fail(const std::string & message)
+    {
+      error = message;
+      state = State::Failed;
+      return false;
+    }
+
+    inline void JsonStringArrayParser::flushSurrogate()
+    {
+      if(highSurrogate)
+      {
+        // unpaired high surrogate
+        details::appendUtf8(current, highSurrogate);
+        highSurrogate = 0;
+      }
+    }
+  }
+}
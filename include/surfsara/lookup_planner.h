@@ -0,0 +1,544 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include "i_reverse_lookup_client.h"
+#include "i_handle_client.h"
+#include <surfsara/ast.h>
+#include <vector>
+#include <string>
+#include <utility>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    /**
+     * Estimates the number of handles matching a KEY=VALUE filter.
+     *
+     * The estimates are learned from the result counts of previous
+     * single filter lookups, separately for exact values and for values
+     * with wildcards of each key. Without observations an exact value is
+     * assumed to match one handle and a wildcard the more handles the
+     * fewer literal characters it has.
+     * The statistics can be kept in a JSON file across invocations.
+     */
+    class LookupPlanner
+    {
+    public:
+      using Filter = std::pair<std::string, std::string>;
+      using Query = std::vector<Filter>;
+
+      /**
+       * @param file statistics file, read if it exists and written on
+       *        destruction if new results have been observed.
+       */
+      LookupPlanner(const std::string & _file = "");
+      ~LookupPlanner();
+      LookupPlanner(const LookupPlanner &) = delete;
+      LookupPlanner & operator=(const LookupPlanner &) = delete;
+
+      inline double estimate(const Filter & filter) const;
+      inline void observe(const Filter & filter, std::size_t count);
+
+      /**
+       * Filters of the query ordered by increasing estimate (most selective first).
+       */
+      inline Query plan(const Query & query) const;
+
+      inline void save();
+      inline surfsara::ast::Node toJson() const;
+
+    private:
+      struct Statistics
+      {
+        double mean;
+        std::size_t observations;
+      };
+
+      inline static std::string statisticsKey(const Filter & filter);
+      inline void load();
+
+      std::string file;
+      std::map<std::string, Statistics> statistics;
+      bool modified;
+      mutable std::mutex mutex;
+    };
+
+    /**
+     * Sends multi filter lookups in the order of a LookupPlanner.
+     *
+     * Only the most selective filter is sent first. If it matches no handle
+     * the lookup is done. Otherwise the remaining filters are checked
+     * client-side, either on the records returned with the lookup
+     * (retrieverecords) or on the records of up to maxVerify handles
+     * fetched from the handle server. Larger candidate sets are resolved
+     * by a follow-up request with all filters in planned order.
+     * Single filter lookups are passed through and feed the statistics.
+     */
+    class PlannedReverseLookupClient : public I_ReverseLookupClient
+    {
+    public:
+      /**
+       * @param _pageLimit handles per page of the reverse lookup client (0: unlimited),
+       *        records of a full page may be incomplete and are not filtered client-side
+       * @param _handleClient client to fetch candidate records, nullptr to always
+       *        send a follow-up request
+       */
+      PlannedReverseLookupClient(std::shared_ptr<I_ReverseLookupClient> _client,
+                                 std::shared_ptr<LookupPlanner> _planner,
+                                 std::size_t _pageLimit = 0,
+                                 std::shared_ptr<I_HandleClient> _handleClient = nullptr,
+                                 std::size_t _maxVerify = 16);
+
+      virtual std::vector<std::string> lookup(const std::vector<std::pair<std::string, std::string>> & query) override;
+      virtual std::size_t lookupEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::function<bool(const std::string & handle)> func) override;
+      virtual bool lookupRecords(const std::vector<std::pair<std::string, std::string>> & query,
+                                 std::vector<std::pair<std::string, surfsara::ast::Node>> & records) override;
+
+      inline std::shared_ptr<LookupPlanner> getPlanner() const;
+
+      /**
+       * True if one of the values entries of type key matches the pattern
+       */
+      inline static bool recordMatches(const surfsara::ast::Node & values,
+                                       const std::string & key,
+                                       const std::string & pattern);
+
+    private:
+      /**
+       * Resolve a multi filter query from its most selective filter.
+       * @return false if a follow-up request with plan is required
+       */
+      inline bool select(const LookupPlanner::Query & plan,
+                         std::vector<std::string> & handles);
+
+      std::shared_ptr<I_ReverseLookupClient> client;
+      std::shared_ptr<LookupPlanner> planner;
+      std::size_t pageLimit;
+      std::shared_ptr<I_HandleClient> handleClient;
+      std::size_t maxVerify;
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <surfsara/json_parser.h>
+#include <surfsara/json_format.h>
+#include <surfsara/util.h>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    inline LookupPlanner::LookupPlanner(const std::string & _file)
+      : file(_file), modified(false)
+    {
+      if(!file.empty())
+      {
+        load();
+      }
+    }
+
+    inline LookupPlanner::~LookupPlanner()
+    {
+      try
+      {
+        save();
+      }
+      catch(...)
+      {
+        // the statistics are only a hint
+      }
+    }
+
+    inline std::string LookupPlanner::statisticsKey(const Filter & filter)
+    {
+      return filter.first + (filter.second.find('*') == std::string::npos ? "=" : "*");
+    }
+
+    inline double LookupPlanner::estimate(const Filter & filter) const
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = statistics.find(statisticsKey(filter));
+        if(itr != statistics.end())
+        {
+          return itr->second.mean;
+        }
+      }
+      if(filter.second.find('*') == std::string::npos)
+      {
+        return 1.0;
+      }
+      std::size_t literals = filter.second.size() - std::count(filter.second.begin(), filter.second.end(), '*');
+      return 1000000.0 / double(literals + 1);
+    }
+
+    inline void LookupPlanner::observe(const Filter & filter, std::size_t count)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto key = statisticsKey(filter);
+      auto itr = statistics.find(key);
+      if(itr == statistics.end())
+      {
+        statistics[key] = Statistics{double(count), 1};
+      }
+      else
+      {
+        // moving average, recent lookups weigh more
+        itr->second.mean = 0.8 * itr->second.mean + 0.2 * double(count);
+        itr->second.observations++;
+      }
+      modified = true;
+    }
+
+    inline LookupPlanner::Query LookupPlanner::plan(const Query & query) const
+    {
+      std::vector<std::pair<double, Filter>> estimated;
+      for(auto & filter : query)
+      {
+        estimated.push_back(std::make_pair(estimate(filter), filter));
+      }
+      std::stable_sort(estimated.begin(), estimated.end(),
+                       [](const std::pair<double, Filter> & a, const std::pair<double, Filter> & b) {
+                         return a.first < b.first;
+                       });
+      Query ret;
+      for(auto & p : estimated)
+      {
+        ret.push_back(p.second);
+      }
+      return ret;
+    }
+
+    inline surfsara::ast::Node LookupPlanner::toJson() const
+    {
+      using Object = surfsara::ast::Object;
+      using Integer = surfsara::ast::Integer;
+      using Float = surfsara::ast::Float;
+      std::lock_guard<std::mutex> lock(mutex);
+      Object ret;
+      for(auto & p : statistics)
+      {
+        ret.set(p.first, Object{{"mean", Float(p.second.mean)},
+                                {"observations", Integer(p.second.observations)}});
+      }
+      return ret;
+    }
+
+    inline void LookupPlanner::save()
+    {
+      if(file.empty())
+      {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!modified)
+        {
+          return;
+        }
+        modified = false;
+      }
+      std::string str = surfsara::ast::formatJson(toJson(), true);
+      std::string tmp = file + ".tmp";
+      {
+        std::ofstream ost(tmp);
+        ost << str << std::endl;
+        if(!ost.good())
+        {
+          throw std::runtime_error(std::string("failed to write lookup statistics ") + tmp);
+        }
+      }
+      // concurrent invocations replace the file as a whole
+      if(std::rename(tmp.c_str(), file.c_str()) != 0)
+      {
+        throw std::runtime_error(std::string("failed to write lookup statistics ") + file);
+      }
+    }
+
+    inline void LookupPlanner::load()
+    {
+      using Node = surfsara::ast::Node;
+      using Object = surfsara::ast::Object;
+      using Integer = surfsara::ast::Integer;
+      using Float = surfsara::ast::Float;
+      std::ifstream ist(file.c_str());
+      if(!ist.good())
+      {
+        // no statistics yet
+        return;
+      }
+      std::string str((std::istreambuf_iterator<char>(ist)),
+                      std::istreambuf_iterator<char>());
+      auto node = surfsara::ast::parseJson(str);
+      if(!node.isA<Object>())
+      {
+        throw std::runtime_error(std::string("invalid lookup statistics ") + file);
+      }
+      node.as<Object>().forEach([this](const std::string & key, const Node & entry) {
+          if(!entry.isA<Object>() ||
+             !entry.as<Object>().has("mean") ||
+             !entry.as<Object>().has("observations"))
+          {
+            throw std::runtime_error(std::string("invalid lookup statistics ") + file + ": " + key);
+          }
+          auto mean = entry.as<Object>()["mean"];
+          auto observations = entry.as<Object>()["observations"];
+          Statistics stat{0.0, 0};
+          if(mean.isA<Float>())
+          {
+            stat.mean = mean.as<Float>();
+          }
+          else if(mean.isA<Integer>())
+          {
+            stat.mean = double(mean.as<Integer>());
+          }
+          if(observations.isA<Integer>())
+          {
+            stat.observations = observations.as<Integer>();
+          }
+          statistics[key] = stat;
+        });
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    inline PlannedReverseLookupClient::PlannedReverseLookupClient(std::shared_ptr<I_ReverseLookupClient> _client,
+                                                                  std::shared_ptr<LookupPlanner> _planner,
+                                                                  std::size_t _pageLimit,
+                                                                  std::shared_ptr<I_HandleClient> _handleClient,
+                                                                  std::size_t _maxVerify)
+      : client(_client),
+        planner(_planner),
+        pageLimit(_pageLimit),
+        handleClient(_handleClient),
+        maxVerify(_maxVerify)
+    {
+    }
+
+    inline std::shared_ptr<LookupPlanner> PlannedReverseLookupClient::getPlanner() const
+    {
+      return planner;
+    }
+
+    inline std::vector<std::string> PlannedReverseLookupClient::lookup(const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      if(query.size() < 2)
+      {
+        auto handles = client->lookup(query);
+        if(query.size() == 1 && (pageLimit == 0 || handles.size() < pageLimit))
+        {
+          planner->observe(query[0], handles.size());
+        }
+        return handles;
+      }
+      auto plan = planner->plan(query);
+      std::vector<std::string> handles;
+      if(select(plan, handles))
+      {
+        return handles;
+      }
+      return client->lookup(plan);
+    }
+
+    inline std::size_t PlannedReverseLookupClient::lookupEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                                              std::function<bool(const std::string & handle)> func)
+    {
+      if(query.size() < 2)
+      {
+        // a stream stopped by func has not counted all matches
+        bool complete = true;
+        std::size_t n = client->lookupEach(query, [&func, &complete](const std::string & handle) {
+            complete = func(handle);
+            return complete;
+          });
+        if(query.size() == 1 && complete && (pageLimit == 0 || n < pageLimit))
+        {
+          planner->observe(query[0], n);
+        }
+        return n;
+      }
+      auto plan = planner->plan(query);
+      std::vector<std::string> handles;
+      if(!select(plan, handles))
+      {
+        return client->lookupEach(plan, func);
+      }
+      std::size_t n = 0;
+      for(auto & handle : handles)
+      {
+        n++;
+        if(!func(handle))
+        {
+          break;
+        }
+      }
+      return n;
+    }
+
+    inline bool PlannedReverseLookupClient::lookupRecords(const std::vector<std::pair<std::string, std::string>> & query,
+                                                          std::vector<std::pair<std::string, surfsara::ast::Node>> & records)
+    {
+      return client->lookupRecords(query, records);
+    }
+
+    inline bool PlannedReverseLookupClient::select(const LookupPlanner::Query & plan,
+                                                   std::vector<std::string> & handles)
+    {
+      using Array = surfsara::ast::Array;
+      using Object = surfsara::ast::Object;
+      using Null = surfsara::ast::Null;
+      const LookupPlanner::Filter & first(plan.front());
+      std::vector<std::pair<std::string, surfsara::ast::Node>> records;
+      // more than maxVerify candidates are not fetched one by one
+      std::vector<std::string> candidates;
+      std::size_t cap = (handleClient ? maxVerify : 0);
+      if(client->lookupRecords({first}, records))
+      {
+        if(pageLimit != 0 && records.size() >= pageLimit)
+        {
+          // a full page, the remaining matches are left to the server
+          return false;
+        }
+        if(records.empty() || !records.front().second.isA<Null>())
+        {
+          planner->observe(first, records.size());
+          for(auto & record : records)
+          {
+            bool match = true;
+            for(std::size_t i = 1; match && i < plan.size(); i++)
+            {
+              match = recordMatches(record.second, plan[i].first, plan[i].second);
+            }
+            if(match)
+            {
+              handles.push_back(record.first);
+            }
+          }
+          return true;
+        }
+        // the service ignored retrieverecords, its handles are the candidates
+        for(auto & record : records)
+        {
+          candidates.push_back(record.first);
+        }
+      }
+      else
+      {
+        client->lookupEach({first}, [&candidates, cap](const std::string & handle) {
+            candidates.push_back(handle);
+            return candidates.size() <= cap;
+          });
+      }
+      if(candidates.empty())
+      {
+        planner->observe(first, 0);
+        return true;
+      }
+      if(candidates.size() > cap)
+      {
+        return false;
+      }
+      planner->observe(first, candidates.size());
+      std::vector<std::string> types;
+      for(std::size_t i = 1; i < plan.size(); i++)
+      {
+        if(std::find(types.begin(), types.end(), plan[i].first) == types.end())
+        {
+          types.push_back(plan[i].first);
+        }
+      }
+      for(auto & handle : candidates)
+      {
+        auto res = handleClient->get(handle, types);
+        if(!res.success)
+        {
+          // removed since the lookup
+          continue;
+        }
+        const surfsara::ast::Node & data(res.data.get());
+        if(!data.isA<Object>() || !data.as<Object>().has("values") ||
+           !data.as<Object>().get("values").isA<Array>())
+        {
+          throw std::logic_error(std::string("invalid record of ") + handle);
+        }
+        auto values = data.as<Object>().get("values");
+        bool match = true;
+        for(std::size_t i = 1; match && i < plan.size(); i++)
+        {
+          match = recordMatches(values, plan[i].first, plan[i].second);
+        }
+        if(match)
+        {
+          handles.push_back(handle);
+        }
+      }
+      return true;
+    }
+
+    inline bool PlannedReverseLookupClient::recordMatches(const surfsara::ast::Node & values,
+                                                          const std::string & key,
+                                                          const std::string & pattern)
+    {
+      using Node = surfsara::ast::Node;
+      using Array = surfsara::ast::Array;
+      using Object = surfsara::ast::Object;
+      using String = surfsara::ast::String;
+      using Integer = surfsara::ast::Integer;
+      if(!values.isA<Array>())
+      {
+        return false;
+      }
+      bool match = false;
+      values.as<Array>().forEach([&match, &key, &pattern](const Node & entry) {
+          if(match || !entry.isA<Object>())
+          {
+            return;
+          }
+          auto type = entry.find("type");
+          if(!type.isA<String>() || type.as<String>() != key)
+          {
+            return;
+          }
+          auto value = entry.find("data/value");
+          if(value.isA<String>())
+          {
+            match = surfsara::util::globMatch(pattern, value.as<String>());
+          }
+          else if(value.isA<Integer>())
+          {
+            match = surfsara::util::globMatch(pattern, std::to_string(value.as<Integer>()));
+          }
+        });
+      return match;
+    }
+  }
+}
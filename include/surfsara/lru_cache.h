@@ -0,0 +1,340 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <list>
+#include <iterator>
+#include <unordered_map>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <cstddef>
+
+namespace surfsara
+{
+  namespace util
+  {
+    struct CacheStatistics
+    {
+      std::size_t hits;
+      std::size_t misses;
+      std::size_t revalidations;
+      std::size_t evictions;
+      std::size_t entries;
+      std::size_t bytes;
+
+      CacheStatistics() :
+        hits(0),
+        misses(0),
+        revalidations(0),
+        evictions(0),
+        entries(0),
+        bytes(0) {}
+
+      inline double hitRate() const;
+    };
+
+    /**
+     * Least recently used cache with time to live.
+     *
+     * The cache is bounded by the number of entries and by the accumulated
+     * size of the entries as reported by the size function.
+     * A bound of 0 disables the respective limit, a ttl of 0 disables expiry.
+     * All methods are serialized by an internal mutex.
+     */
+    template<typename K, typename V>
+    class LruCache
+    {
+    public:
+      using Clock = std::chrono::steady_clock;
+      using SizeFunction = std::function<std::size_t(const K & key, const V & value)>;
+
+      LruCache(std::size_t _maxEntries,
+               std::size_t _maxBytes = 0,
+               std::chrono::milliseconds _ttl = std::chrono::milliseconds(0),
+               SizeFunction _sizeOf = nullptr);
+
+      /**
+       * Copy the value of a valid entry to value.
+       * @return false if the key is not cached or the entry is expired
+       */
+      inline bool get(const K & key, V & value);
+
+      /**
+       * Copy the value of an entry to value, including expired entries.
+       * Expired entries are kept (and counted as miss) so that they can be
+       * revalidated with the origin and refreshed.
+       * @return false if the key is not cached
+       */
+      inline bool get(const K & key, V & value, bool & expired);
+
+      /**
+       * Restart the time to live of an entry that has been confirmed
+       * by the origin. The revalidated lookup is accounted as hit.
+       */
+      inline bool refresh(const K & key);
+
+      /**
+       * Insert or replace an entry.
+       */
+      inline void put(const K & key, const V & value);
+
+      /**
+       * Modify a cached entry in place (write-through).
+       * func is called with the cache locked and must not access the cache.
+       * @return false if the key is not cached
+       */
+      inline bool modify(const K & key, std::function<void(V & value)> func);
+
+      inline bool erase(const K & key);
+      inline void clear();
+      inline CacheStatistics getStatistics() const;
+
+    private:
+      struct Entry
+      {
+        K key;
+        V value;
+        std::size_t bytes;
+        Clock::time_point expires;
+      };
+      using EntryList = std::list<Entry>;
+
+      inline std::size_t sizeOfEntry(const K & key, const V & value) const;
+      inline void evictEntry(typename EntryList::iterator itr);
+      inline void shrink();
+
+      std::size_t maxEntries;
+      std::size_t maxBytes;
+      std::chrono::milliseconds ttl;
+      SizeFunction sizeOf;
+      EntryList entries;
+      std::unordered_map<K, typename EntryList::iterator> index;
+      CacheStatistics stats;
+      mutable std::mutex mutex;
+    };
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+////////////////////////////////////////////////////////////////////
+namespace surfsara
+{
+  namespace util
+  {
+    inline double CacheStatistics::hitRate() const
+    {
+      if(hits + misses == 0)
+      {
+        return 0.0;
+      }
+      return double(hits) / double(hits + misses);
+    }
+
+    template<typename K, typename V>
+    LruCache<K, V>::LruCache(std::size_t _maxEntries,
+                             std::size_t _maxBytes,
+                             std::chrono::milliseconds _ttl,
+                             SizeFunction _sizeOf)
+      : maxEntries(_maxEntries),
+        maxBytes(_maxBytes),
+        ttl(_ttl),
+        sizeOf(_sizeOf)
+    {
+    }
+
+    template<typename K, typename V>
+    inline bool LruCache<K, V>::get(const K & key, V & value)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr == index.end())
+      {
+        stats.misses++;
+        return false;
+      }
+      if(ttl.count() > 0 && itr->second->expires <= Clock::now())
+      {
+        evictEntry(itr->second);
+        stats.misses++;
+        return false;
+      }
+      entries.splice(entries.begin(), entries, itr->second);
+      value = itr->second->value;
+      stats.hits++;
+      return true;
+    }
+
+    template<typename K, typename V>
+    inline bool LruCache<K, V>::get(const K & key, V & value, bool & expired)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr == index.end())
+      {
+        stats.misses++;
+        return false;
+      }
+      expired = (ttl.count() > 0 && itr->second->expires <= Clock::now());
+      if(expired)
+      {
+        stats.misses++;
+      }
+      else
+      {
+        stats.hits++;
+      }
+      entries.splice(entries.begin(), entries, itr->second);
+      value = itr->second->value;
+      return true;
+    }
+
+    template<typename K, typename V>
+    inline bool LruCache<K, V>::refresh(const K & key)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr == index.end())
+      {
+        return false;
+      }
+      itr->second->expires = Clock::now() + ttl;
+      stats.revalidations++;
+      if(stats.misses > 0)
+      {
+        stats.misses--;
+      }
+      stats.hits++;
+      return true;
+    }
+
+    template<typename K, typename V>
+    inline void LruCache<K, V>::put(const K & key, const V & value)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr != index.end())
+      {
+        stats.bytes -= itr->second->bytes;
+        entries.erase(itr->second);
+        index.erase(itr);
+      }
+      Entry entry{key, value, sizeOfEntry(key, value), Clock::now() + ttl};
+      if(maxBytes > 0 && entry.bytes > maxBytes)
+      {
+        // would evict everything else and still not fit
+        stats.entries = entries.size();
+        return;
+      }
+      entries.push_front(entry);
+      index[key] = entries.begin();
+      stats.bytes += entry.bytes;
+      shrink();
+      stats.entries = entries.size();
+    }
+
+    template<typename K, typename V>
+    inline bool LruCache<K, V>::modify(const K & key, std::function<void(V & value)> func)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr == index.end())
+      {
+        return false;
+      }
+      Entry & entry(*itr->second);
+      func(entry.value);
+      stats.bytes -= entry.bytes;
+      entry.bytes = sizeOfEntry(entry.key, entry.value);
+      stats.bytes += entry.bytes;
+      entries.splice(entries.begin(), entries, itr->second);
+      shrink();
+      stats.entries = entries.size();
+      return true;
+    }
+
+    template<typename K, typename V>
+    inline bool LruCache<K, V>::erase(const K & key)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto itr = index.find(key);
+      if(itr == index.end())
+      {
+        return false;
+      }
+      stats.bytes -= itr->second->bytes;
+      entries.erase(itr->second);
+      index.erase(itr);
+      stats.entries = entries.size();
+      return true;
+    }
+
+    template<typename K, typename V>
+    inline void LruCache<K, V>::clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.clear();
+      index.clear();
+      stats.bytes = 0;
+      stats.entries = 0;
+    }
+
+    template<typename K, typename V>
+    inline CacheStatistics LruCache<K, V>::getStatistics() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats;
+    }
+
+    template<typename K, typename V>
+    inline std::size_t LruCache<K, V>::sizeOfEntry(const K & key, const V & value) const
+    {
+      if(sizeOf)
+      {
+        return sizeOf(key, value);
+      }
+      else
+      {
+        return 1;
+      }
+    }
+
+    template<typename K, typename V>
+    inline void LruCache<K, V>::evictEntry(typename EntryList::iterator itr)
+    {
+      stats.bytes -= itr->bytes;
+      stats.evictions++;
+      index.erase(itr->key);
+      entries.erase(itr);
+      stats.entries = entries.size();
+    }
+
+    template<typename K, typename V>
+    inline void LruCache<K, V>::shrink()
+    {
+      while(!entries.empty() &&
+            ((maxEntries > 0 && entries.size() > maxEntries) ||
+             (maxBytes > 0 && stats.bytes > maxBytes)))
+      {
+        evictEntry(std::prev(entries.end()));
+      }
+    }
+  }
+}
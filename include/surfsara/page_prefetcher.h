@@ -0,0 +1,214 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <limits>
+#include <cstddef>
+
+namespace surfsara
+{
+  namespace util
+  {
+    /**
+     * Fetches the pages of a paginated result concurrently and delivers
+     * their items in page order.
+     *
+     * Up to window pages are requested ahead of the consumer.
+     * The window grows by one while the consumer has to wait for the next
+     * page and is halved when the response time exceeds three times the
+     * fastest response seen, i.e. when the server starts to queue requests.
+     *
+     * No page after a short page is requested once it has arrived, even
+     * if the consumer has not reached it yet. Requests that were issued
+     * before are skipped if they have not started, otherwise their
+     * responses are discarded.
+     */
+    class PagePrefetcher
+    {
+    public:
+      using Page = std::vector<std::string>;
+      using FetchFunction = std::function<Page(std::size_t page)>;
+      using Clock = std::chrono::steady_clock;
+
+      PagePrefetcher(FetchFunction _fetch,
+                     std::size_t _pageSize,
+                     std::size_t _maxWindow,
+                     std::size_t _initialWindow = 2);
+
+      /**
+       * Deliver the items of page firstPage, firstPage + 1, ... until
+       * a page is shorter than pageSize or func returns false.
+       * @return number of items passed to func
+       */
+      inline std::size_t forEach(std::size_t firstPage,
+                                 std::function<bool(const std::string & item)> func);
+
+      inline std::size_t getWindow() const;
+
+    private:
+      struct TimedPage
+      {
+        Page items;
+        Clock::duration latency;
+      };
+
+      inline void adapt(Clock::duration latency, bool waited);
+
+      FetchFunction fetch;
+      std::size_t pageSize;
+      std::size_t maxWindow;
+      std::size_t window;
+      Clock::duration minLatency;
+    };
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+////////////////////////////////////////////////////////////////////
+namespace surfsara
+{
+  namespace util
+  {
+    inline PagePrefetcher::PagePrefetcher(FetchFunction _fetch,
+                                          std::size_t _pageSize,
+                                          std::size_t _maxWindow,
+                                          std::size_t _initialWindow)
+      : fetch(_fetch),
+        pageSize(_pageSize),
+        maxWindow(_maxWindow > 0 ? _maxWindow : 1),
+        window(_initialWindow),
+        minLatency(Clock::duration::zero())
+    {
+      if(window > maxWindow)
+      {
+        window = maxWindow;
+      }
+      if(window == 0)
+      {
+        window = 1;
+      }
+    }
+
+    inline std::size_t PagePrefetcher::forEach(std::size_t firstPage,
+                                               std::function<bool(const std::string & item)> func)
+    {
+      // index of the last page, lowered by the first short page that arrives
+      std::atomic<std::size_t> last(std::numeric_limits<std::size_t>::max());
+      auto setLast = [&last](std::size_t page) {
+        std::size_t current = last;
+        while(page < current && !last.compare_exchange_weak(current, page)) {}
+      };
+      // declared after last: pending requests are waited for when the futures are destroyed
+      std::deque<std::future<TimedPage>> inFlight;
+      std::size_t nextPage = firstPage;
+      std::size_t n = 0;
+      std::string firstOfPrevious;
+      bool first = true;
+      while(true)
+      {
+        while(inFlight.size() < window && nextPage <= last)
+        {
+          FetchFunction f(fetch);
+          std::size_t page = nextPage++;
+          std::size_t size = pageSize;
+          inFlight.push_back(std::async(std::launch::async, [f, page, size, &last, &setLast]() {
+                TimedPage ret;
+                ret.latency = Clock::duration::zero();
+                if(page > last)
+                {
+                  return ret;
+                }
+                auto start = Clock::now();
+                ret.items = f(page);
+                ret.latency = Clock::now() - start;
+                if(size == 0 || ret.items.size() < size)
+                {
+                  setLast(page);
+                }
+                return ret;
+              }));
+        }
+        if(inFlight.empty())
+        {
+          break;
+        }
+        bool waited = (inFlight.front().wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+        TimedPage page = inFlight.front().get();
+        inFlight.pop_front();
+        std::size_t current = nextPage - inFlight.size() - 1;
+        adapt(page.latency, waited);
+        if(page.items.empty())
+        {
+          break;
+        }
+        if(!first && page.items.front() == firstOfPrevious)
+        {
+          // the server ignores the page parameter
+          setLast(current);
+          break;
+        }
+        first = false;
+        firstOfPrevious = page.items.front();
+        for(auto & item : page.items)
+        {
+          n++;
+          if(!func(item))
+          {
+            setLast(current);
+            return n;
+          }
+        }
+        if(pageSize == 0 || page.items.size() < pageSize)
+        {
+          break;
+        }
+      }
+      return n;
+    }
+
+    inline std::size_t PagePrefetcher::getWindow() const
+    {
+      return window;
+    }
+
+    inline void PagePrefetcher::adapt(Clock::duration latency, bool waited)
+    {
+      if(minLatency == Clock::duration::zero() || latency < minLatency)
+      {
+        minLatency = latency;
+      }
+      if(latency > minLatency * 3)
+      {
+        window = (window > 1 ? window / 2 : 1);
+      }
+      else if(waited && window < maxWindow)
+      {
+        window++;
+      }
+    }
+  }
+}
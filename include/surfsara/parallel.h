@@ -0,0 +1,164 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <cstddef>
+
+namespace surfsara
+{
+  namespace util
+  {
+    /**
+     * Call func(i) for i in [0, n) on up to concurrency threads.
+     * With concurrency <= 1 the calls are made in order on the calling thread.
+     * The first exception stops the remaining calls and is rethrown
+     * after all threads have finished.
+     */
+    inline void parallelFor(std::size_t n,
+                            std::size_t concurrency,
+                            std::function<void(std::size_t i)> func);
+
+    /**
+     * Token bucket shared by several threads: acquire blocks until the
+     * next call is allowed. perSecond <= 0 disables the limit.
+     */
+    class RateLimiter
+    {
+    public:
+      RateLimiter(double _perSecond, std::size_t _burst = 1);
+
+      inline void acquire();
+
+    private:
+      using Clock = std::chrono::steady_clock;
+      double perSecond;
+      double burst;
+      double tokens;
+      Clock::time_point last;
+      std::mutex mutex;
+    };
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace surfsara
+{
+  namespace util
+  {
+    inline void parallelFor(std::size_t n,
+                            std::size_t concurrency,
+                            std::function<void(std::size_t i)> func)
+    {
+      if(concurrency <= 1 || n <= 1)
+      {
+        for(std::size_t i = 0; i < n; i++)
+        {
+          func(i);
+        }
+        return;
+      }
+      std::atomic<std::size_t> next(0);
+      std::atomic<bool> failed(false);
+      std::exception_ptr error;
+      std::mutex errorMutex;
+      auto worker = [&]() {
+        std::size_t i;
+        while(!failed && (i = next++) < n)
+        {
+          try
+          {
+            func(i);
+          }
+          catch(...)
+          {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if(!error)
+            {
+              error = std::current_exception();
+            }
+            failed = true;
+          }
+        }
+      };
+      std::vector<std::thread> threads;
+      std::size_t nthreads = (concurrency < n ? concurrency : n);
+      // the calling thread is one of the workers
+      for(std::size_t t = 1; t < nthreads; t++)
+      {
+        threads.push_back(std::thread(worker));
+      }
+      worker();
+      for(auto & t : threads)
+      {
+        t.join();
+      }
+      if(error)
+      {
+        std::rethrow_exception(error);
+      }
+    }
+
+    inline RateLimiter::RateLimiter(double _perSecond, std::size_t _burst)
+      : perSecond(_perSecond),
+        burst(_burst ? double(_burst) : 1.0),
+        tokens(_burst ? double(_burst) : 1.0),
+        last(Clock::now())
+    {
+    }
+
+    inline void RateLimiter::acquire()
+    {
+      if(perSecond <= 0)
+      {
+        return;
+      }
+      double wait = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = Clock::now();
+        tokens += std::chrono::duration<double>(now - last).count() * perSecond;
+        if(tokens > burst)
+        {
+          tokens = burst;
+        }
+        last = now;
+        // a negative balance reserves the next tokens for the waiting threads
+        tokens -= 1.0;
+        if(tokens < 0)
+        {
+          wait = -tokens / perSecond;
+        }
+      }
+      if(wait > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+      }
+    }
+  }
+}
@@ -0,0 +1,447 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <surfsara/util.h>
+
+namespace surfsara
+{
+  namespace util
+  {
+    /**
+     * Persistent hash index of key hash -> value in a memory mapped file.
+     *
+     * The table has a fixed number of slots with linear probing. Keys are
+     * represented by their 64 bit hash only, values are limited to 119 bytes
+     * (longer values are not indexed).
+     *
+     * Readers do not lock: a sequence counter in the file is odd while a
+     * writer modifies the table and readers retry if it changed during
+     * their probe. Writers of all processes are serialized by flock.
+     */
+    class PathIndex
+    {
+    public:
+      static const std::size_t maxValueSize = 119;
+
+      /**
+       * Open or create the index file.
+       * @param slots number of slots of a new file, an existing file keeps its size
+       */
+      PathIndex(const std::string & file, std::size_t slots = 262144);
+      ~PathIndex();
+      PathIndex(const PathIndex &) = delete;
+      PathIndex & operator=(const PathIndex &) = delete;
+
+      /**
+       * @return false if the key is not indexed or a writer kept the
+       *         table busy for too long
+       */
+      inline bool get(const std::string & key, std::string & value) const;
+
+      /**
+       * Insert or replace an entry.
+       * @return false if the value is too long or the table is full
+       */
+      inline bool put(const std::string & key, const std::string & value);
+      inline bool erase(const std::string & key);
+      inline void clear();
+
+      inline std::size_t size() const;
+      inline std::size_t capacity() const;
+
+    private:
+      static const std::size_t slotWords = 16;
+      struct Header
+      {
+        char magic[8];
+        std::uint64_t slots;
+        std::uint64_t used;
+        std::uint64_t tombstones;
+        std::uint64_t seq;
+      };
+      struct Slot
+      {
+        std::uint64_t words[slotWords];
+      };
+
+      /**
+       * Serializes writers of this and other processes.
+       * The table is rebuilt if a previous writer died in the middle of a change.
+       */
+      class WriteLock
+      {
+      public:
+        WriteLock(PathIndex & _index);
+        ~WriteLock();
+      private:
+        PathIndex & index;
+        std::lock_guard<std::mutex> guard;
+      };
+
+      inline static std::uint64_t hashKey(const std::string & key);
+      inline void beginWrite();
+      inline void endWrite();
+      inline void store(std::size_t slot, std::uint64_t hash, const std::string & value);
+      inline void storeHash(std::size_t slot, std::uint64_t hash);
+      inline std::uint64_t loadHash(std::size_t slot) const;
+      inline std::string loadValue(std::size_t slot) const;
+      inline bool find(std::uint64_t hash, std::size_t & slot) const;
+      inline void compact();
+
+      std::string file;
+      int fd;
+      std::size_t mappedSize;
+      void * mapped;
+      Header * header;
+      Slot * table;
+      std::mutex mutex;
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace surfsara
+{
+  namespace util
+  {
+    namespace details
+    {
+      static const char pathIndexMagic[8] = {'S', 'P', 'I', 'D', 'X', '0', '0', '1'};
+      // hash values of free slots
+      static const std::uint64_t pathIndexEmpty = 0;
+      static const std::uint64_t pathIndexTombstone = 1;
+    }
+
+    inline PathIndex::PathIndex(const std::string & _file, std::size_t slots)
+      : file(_file), fd(-1), mappedSize(0), mapped(nullptr), header(nullptr), table(nullptr)
+    {
+      fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+      if(fd < 0)
+      {
+        throw std::runtime_error(std::string("failed to open path index ") + file +
+                                 ": " + std::strerror(errno));
+      }
+      if(slots == 0)
+      {
+        slots = 1;
+      }
+      flock(fd, LOCK_EX);
+      struct stat st;
+      bool ok = (fstat(fd, &st) == 0);
+      if(ok && st.st_size == 0)
+      {
+        Header init;
+        std::memset(&init, 0, sizeof(init));
+        std::memcpy(init.magic, details::pathIndexMagic, sizeof(init.magic));
+        init.slots = slots;
+        mappedSize = sizeof(Header) + slots * sizeof(Slot);
+        ok = (ftruncate(fd, mappedSize) == 0 &&
+              pwrite(fd, &init, sizeof(init), 0) == ssize_t(sizeof(init)));
+      }
+      else if(ok)
+      {
+        Header existing;
+        ok = (std::size_t(st.st_size) >= sizeof(Header) &&
+              pread(fd, &existing, sizeof(existing), 0) == ssize_t(sizeof(existing)) &&
+              std::memcmp(existing.magic, details::pathIndexMagic, sizeof(existing.magic)) == 0 &&
+              existing.slots > 0 &&
+              std::uint64_t(st.st_size) == sizeof(Header) + existing.slots * sizeof(Slot));
+        mappedSize = st.st_size;
+      }
+      flock(fd, LOCK_UN);
+      void * ptr = MAP_FAILED;
+      if(ok)
+      {
+        ptr = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      if(ptr == MAP_FAILED)
+      {
+        ::close(fd);
+        throw std::runtime_error(std::string("invalid path index file ") + file);
+      }
+      mapped = ptr;
+      header = static_cast<Header*>(ptr);
+      table = reinterpret_cast<Slot*>(static_cast<char*>(ptr) + sizeof(Header));
+    }
+
+    inline PathIndex::~PathIndex()
+    {
+      munmap(mapped, mappedSize);
+      ::close(fd);
+    }
+
+    inline PathIndex::WriteLock::WriteLock(PathIndex & _index)
+      : index(_index), guard(_index.mutex)
+    {
+      // the mutex excludes threads of this process, which share the descriptor
+      flock(index.fd, LOCK_EX);
+      if(__atomic_load_n(&index.header->seq, __ATOMIC_RELAXED) & 1)
+      {
+        // the previous writer died, the table may be inconsistent
+        std::memset(static_cast<void*>(index.table), 0, index.header->slots * sizeof(Slot));
+        __atomic_store_n(&index.header->used, 0, __ATOMIC_RELAXED);
+        index.header->tombstones = 0;
+        index.endWrite();
+      }
+    }
+
+    inline PathIndex::WriteLock::~WriteLock()
+    {
+      flock(index.fd, LOCK_UN);
+    }
+
+    inline std::uint64_t PathIndex::hashKey(const std::string & key)
+    {
+      std::uint64_t h = fnv1a(key);
+      return (h <= details::pathIndexTombstone) ? h + 2 : h;
+    }
+
+    inline void PathIndex::beginWrite()
+    {
+      __atomic_store_n(&header->seq, header->seq + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    inline void PathIndex::endWrite()
+    {
+      __atomic_store_n(&header->seq, (header->seq + 1) & ~std::uint64_t(1), __ATOMIC_RELEASE);
+    }
+
+    inline void PathIndex::store(std::size_t slot, std::uint64_t hash, const std::string & value)
+    {
+      Slot tmp;
+      std::memset(&tmp, 0, sizeof(tmp));
+      tmp.words[0] = hash;
+      char * bytes = reinterpret_cast<char*>(&tmp.words[1]);
+      bytes[0] = static_cast<char>(value.size());
+      std::memcpy(bytes + 1, value.c_str(), value.size());
+      for(std::size_t i = 0; i < slotWords; i++)
+      {
+        __atomic_store_n(&table[slot].words[i], tmp.words[i], __ATOMIC_RELAXED);
+      }
+    }
+
+    inline void PathIndex::storeHash(std::size_t slot, std::uint64_t hash)
+    {
+      __atomic_store_n(&table[slot].words[0], hash, __ATOMIC_RELAXED);
+    }
+
+    inline std::uint64_t PathIndex::loadHash(std::size_t slot) const
+    {
+      return __atomic_load_n(&table[slot].words[0], __ATOMIC_RELAXED);
+    }
+
+    inline std::string PathIndex::loadValue(std::size_t slot) const
+    {
+      Slot tmp;
+      for(std::size_t i = 1; i < slotWords; i++)
+      {
+        tmp.words[i] = __atomic_load_n(&table[slot].words[i], __ATOMIC_RELAXED);
+      }
+      const char * bytes = reinterpret_cast<const char*>(&tmp.words[1]);
+      std::size_t n = static_cast<unsigned char>(bytes[0]);
+      // torn reads are discarded by the caller, but must stay in bounds
+      return std::string(bytes + 1, n > maxValueSize ? maxValueSize : n);
+    }
+
+    inline bool PathIndex::find(std::uint64_t hash, std::size_t & slot) const
+    {
+      std::size_t slots = header->slots;
+      std::size_t start = hash % slots;
+      for(std::size_t i = 0; i < slots; i++)
+      {
+        slot = (start + i) % slots;
+        std::uint64_t h = loadHash(slot);
+        if(h == hash)
+        {
+          return true;
+        }
+        else if(h == details::pathIndexEmpty)
+        {
+          return false;
+        }
+      }
+      return false;
+    }
+
+    inline bool PathIndex::get(const std::string & key, std::string & value) const
+    {
+      std::uint64_t hash = hashKey(key);
+      for(int attempt = 0; attempt < 1000; attempt++)
+      {
+        std::uint64_t seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+        {
+          std::this_thread::yield();
+          continue;
+        }
+        std::size_t slot;
+        bool found = find(hash, slot);
+        std::string tmp;
+        if(found)
+        {
+          tmp = loadValue(slot);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&header->seq, __ATOMIC_RELAXED) == seq)
+        {
+          if(found)
+          {
+            value.swap(tmp);
+          }
+          return found;
+        }
+      }
+      return false;
+    }
+
+    inline bool PathIndex::put(const std::string & key, const std::string & value)
+    {
+      if(value.size() > maxValueSize)
+      {
+        return false;
+      }
+      std::uint64_t hash = hashKey(key);
+      WriteLock lock(*this);
+      std::size_t slot;
+      if(find(hash, slot))
+      {
+        beginWrite();
+        store(slot, hash, value);
+        endWrite();
+        return true;
+      }
+      // keep a quarter of the slots free, so that probes of missing keys stay short
+      if((header->used + 1) * 4 > header->slots * 3)
+      {
+        return false;
+      }
+      beginWrite();
+      if((header->used + header->tombstones + 1) * 4 > header->slots * 3)
+      {
+        compact();
+      }
+      std::size_t slots = header->slots;
+      std::size_t start = hash % slots;
+      for(std::size_t i = 0; i < slots; i++)
+      {
+        slot = (start + i) % slots;
+        std::uint64_t h = loadHash(slot);
+        if(h == details::pathIndexEmpty || h == details::pathIndexTombstone)
+        {
+          if(h == details::pathIndexTombstone)
+          {
+            header->tombstones--;
+          }
+          store(slot, hash, value);
+          __atomic_add_fetch(&header->used, 1, __ATOMIC_RELAXED);
+          break;
+        }
+      }
+      endWrite();
+      return true;
+    }
+
+    inline bool PathIndex::erase(const std::string & key)
+    {
+      std::uint64_t hash = hashKey(key);
+      WriteLock lock(*this);
+      std::size_t slot;
+      if(!find(hash, slot))
+      {
+        return false;
+      }
+      beginWrite();
+      storeHash(slot, details::pathIndexTombstone);
+      __atomic_sub_fetch(&header->used, 1, __ATOMIC_RELAXED);
+      header->tombstones++;
+      endWrite();
+      return true;
+    }
+
+    inline void PathIndex::clear()
+    {
+      WriteLock lock(*this);
+      beginWrite();
+      for(std::size_t slot = 0; slot < header->slots; slot++)
+      {
+        storeHash(slot, details::pathIndexEmpty);
+      }
+      __atomic_store_n(&header->used, 0, __ATOMIC_RELAXED);
+      header->tombstones = 0;
+      endWrite();
+    }
+
+    inline void PathIndex::compact()
+    {
+      // called by a writer between beginWrite and endWrite
+      std::vector<std::pair<std::uint64_t, std::string>> entries;
+      for(std::size_t slot = 0; slot < header->slots; slot++)
+      {
+        std::uint64_t h = loadHash(slot);
+        if(h > details::pathIndexTombstone)
+        {
+          entries.push_back(std::make_pair(h, loadValue(slot)));
+        }
+        storeHash(slot, details::pathIndexEmpty);
+      }
+      std::size_t slots = header->slots;
+      for(auto & entry : entries)
+      {
+        std::size_t slot = entry.first % slots;
+        while(loadHash(slot) != details::pathIndexEmpty)
+        {
+          slot = (slot + 1) % slots;
+        }
+        store(slot, entry.first, entry.second);
+      }
+      __atomic_store_n(&header->used, entries.size(), __ATOMIC_RELAXED);
+      header->tombstones = 0;
+    }
+
+    inline std::size_t PathIndex::size() const
+    {
+      return __atomic_load_n(&header->used, __ATOMIC_RELAXED);
+    }
+
+    inline std::size_t PathIndex::capacity() const
+    {
+      return header->slots;
+    }
+  }
+}
@@ -20,32 +20,186 @@ limitations under the License.
 #include <surfsara/curl.h>
 #include <surfsara/json_format.h>
 #include <surfsara/json_parser.h>
+#include <surfsara/util.h>
+#include <surfsara/page_prefetcher.h>
+#include <surfsara/parallel.h>
+#include <surfsara/json_scanner.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 
 namespace surfsara
 {
   namespace handle
   {
+    /**
+     * Bounds of the adaptive page size of ReverseLookupClient::lookupEach.
+     *
+     * The page size is a power of two between minLimit and maxLimit.
+     * After each full page it is doubled if the page took less than half
+     * of targetLatency and halved if it took longer than targetLatency.
+     * A targetLatency of 0 disables the adaptation.
+     */
+    struct AdaptivePaging
+    {
+      AdaptivePaging(std::size_t _minLimit = 1,
+                     std::size_t _maxLimit = 0,
+                     std::chrono::milliseconds _targetLatency = std::chrono::milliseconds(0));
+
+      inline bool isEnabled() const;
+
+      /**
+       * Power of two within the bounds, not larger than limit if possible.
+       */
+      inline std::size_t clamp(std::size_t limit) const;
+
+      /**
+       * Page size after a page of limit handles has returned handles in elapsed.
+       * The result divides offset, the position of the next page.
+       */
+      inline std::size_t next(std::size_t limit,
+                              std::size_t handles,
+                              std::chrono::microseconds elapsed,
+                              std::size_t offset) const;
+
+      std::size_t minLimit;
+      std::size_t maxLimit;
+      std::chrono::milliseconds targetLatency;
+    };
+
+    /**
+     * Instances can be shared between threads. Only the statistics and
+     * the adaptive page size change after construction.
+     */
     class ReverseLookupClient : public I_ReverseLookupClient
     {
     public:
+      struct Statistics
+      {
+        // requests sent to the lookup service
+        std::size_t requests;
+        // handles received
+        std::size_t handles;
+        // accumulated time of the requests
+        std::chrono::microseconds time;
+        // current page size of lookupEach
+        std::size_t pageSize;
+      };
+
       ReverseLookupClient(const std::string & url,
                           const std::string & prefix,
                           std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> options,
                           std::size_t _lookup_limit,
                           std::size_t _lookup_page,
-                          bool _verbose = false);
+                          bool _verbose = false,
+                          std::size_t _lookup_prefetch = 0,
+                          std::size_t _lookup_concurrency = 1,
+                          bool _retrieve_records = false,
+                          AdaptivePaging _paging = AdaptivePaging());
+      /**
+       * Single page (lookup_limit, lookup_page) of matching handles.
+       */
       virtual std::vector<std::string> lookup(const std::vector<std::pair<std::string, std::string>> & query) override
       {
         return lookupImpl(query);
       }
+
+      /**
+       * All matching handles, starting at lookup_page and requesting
+       * lookup_limit handles per page. Only one page is held in memory,
+       * or up to lookup_prefetch pages that are fetched concurrently.
+       * Without prefetch the page size adapts to the response time if
+       * adaptive paging is enabled, the size carries over to the next call.
+       */
+      virtual std::size_t lookupEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::function<bool(const std::string & handle)> func) override
+      {
+        return lookupEachImpl(query, func);
+      }
+
+      /**
+       * Single page of each query, up to lookup_concurrency queries are
+       * sent at the same time. The lookup service has no OR filter, so
+       * only identical queries are combined.
+       */
+      virtual std::vector<std::vector<std::string>> lookupMany(const std::vector<std::vector<std::pair<std::string, std::string>>> & queries) override
+      {
+        return lookupManyImpl(queries);
+      }
+
+      /**
+       * Single page of matching handles with their values if
+       * retrieve_records is enabled. If the server ignores retrieverecords,
+       * the handles of its reply are returned with null values.
+       */
+      virtual bool lookupRecords(const std::vector<std::pair<std::string, std::string>> & query,
+                                 std::vector<std::pair<std::string, surfsara::ast::Node>> & records) override
+      {
+        return lookupRecordsImpl(query, records);
+      }
+
+      /**
+       * All pages of matching handles with their values if
+       * retrieve_records is enabled. After the server has ignored
+       * retrieverecords once, no records are requested anymore.
+       */
+      virtual bool lookupRecordsEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::function<bool(const std::string & handle,
+                                                        const surfsara::ast::Node & values)> func) override
+      {
+        return lookupRecordsEachImpl(query, func);
+      }
+
+      inline Statistics getStatistics() const;
+
     private:
       inline std::vector<std::string> lookupImpl(const std::vector<std::pair<std::string, std::string>> & query);
+      inline std::size_t lookupEachImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                        std::function<bool(const std::string & handle)> func);
+      inline std::vector<std::vector<std::string>> lookupManyImpl(const std::vector<std::vector<std::pair<std::string, std::string>>> & queries);
+      inline bool lookupRecordsImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                    std::vector<std::pair<std::string, surfsara::ast::Node>> & records);
+      inline bool lookupRecordsEachImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                        std::function<bool(const std::string & handle,
+                                                           const surfsara::ast::Node & values)> func);
+
+      /**
+       * @return false if the server does not return records, records
+       *         holds the handles of the reply with null values then
+       */
+      inline bool requestRecordsPage(const std::vector<std::pair<std::string, std::string>> & query,
+                                     std::size_t limit,
+                                     std::size_t page,
+                                     std::vector<std::pair<std::string, surfsara::ast::Node>> & records);
+      inline std::vector<std::string> requestPage(const std::vector<std::pair<std::string, std::string>> & query,
+                                                  std::size_t limit,
+                                                  std::size_t page);
+
+      /**
+       * Parse the response while it is received and call func for each
+       * handle, the page is not held in memory.
+       * @return false if func stopped the transfer
+       */
+      inline bool streamPage(const std::vector<std::pair<std::string, std::string>> & query,
+                             std::size_t limit,
+                             std::size_t page,
+                             std::function<bool(const std::string & handle)> func);
       std::string url;
       std::string prefix;
       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> options;
       std::size_t lookup_limit;
       std::size_t lookup_page;
       bool verbose;
+      std::size_t lookup_prefetch;
+      std::size_t lookup_concurrency;
+      bool retrieve_records;
+      // the server has answered a lookup with retrieverecords without records
+      std::atomic<bool> records_ignored;
+      AdaptivePaging paging;
+      std::atomic<std::size_t> pageSize;
+      std::atomic<std::size_t> requests;
+      std::atomic<std::size_t> handles;
+      std::atomic<std::int64_t> microseconds;
     };
   }
 }
@@ -59,33 +213,213 @@ namespace surfsara
 {
   namespace handle
   {
+    inline AdaptivePaging::AdaptivePaging(std::size_t _minLimit,
+                                          std::size_t _maxLimit,
+                                          std::chrono::milliseconds _targetLatency)
+      : minLimit(_minLimit ? _minLimit : 1),
+        maxLimit(_maxLimit),
+        targetLatency(_targetLatency)
+    {
+    }
+
+    inline bool AdaptivePaging::isEnabled() const
+    {
+      return targetLatency.count() > 0;
+    }
+
+    inline std::size_t AdaptivePaging::clamp(std::size_t limit) const
+    {
+      std::size_t p = 1;
+      while(p <= limit / 2)
+      {
+        p *= 2;
+      }
+      while(p < minLimit)
+      {
+        p *= 2;
+      }
+      while(maxLimit > 0 && p > maxLimit && p > 1)
+      {
+        p /= 2;
+      }
+      return p;
+    }
+
+    inline std::size_t AdaptivePaging::next(std::size_t limit,
+                                            std::size_t handles,
+                                            std::chrono::microseconds elapsed,
+                                            std::size_t offset) const
+    {
+      if(!isEnabled() || handles < limit)
+      {
+        return limit;
+      }
+      std::chrono::microseconds target(targetLatency);
+      if(elapsed > target && limit / 2 >= minLimit && limit > 1)
+      {
+        // a divisor of limit also divides offset
+        return limit / 2;
+      }
+      if(elapsed * 2 < target && (maxLimit == 0 || limit * 2 <= maxLimit) &&
+         offset % (limit * 2) == 0)
+      {
+        return limit * 2;
+      }
+      return limit;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
     inline ReverseLookupClient::ReverseLookupClient(const std::string & _url,
                                                     const std::string & _prefix,
                                                     std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> _options,
                                                     std::size_t _lookup_limit,
                                                     std::size_t _lookup_page,
-                                                    bool _verbose)
+                                                    bool _verbose,
+                                                    std::size_t _lookup_prefetch,
+                                                    std::size_t _lookup_concurrency,
+                                                    bool _retrieve_records,
+                                                    AdaptivePaging _paging)
       : url(_url), prefix(_prefix), options(_options),
         lookup_limit(_lookup_limit),
         lookup_page(_lookup_page),
-        verbose(_verbose)
+        verbose(_verbose),
+        lookup_prefetch(_lookup_prefetch),
+        lookup_concurrency(_lookup_concurrency),
+        retrieve_records(_retrieve_records),
+        records_ignored(false),
+        paging(_paging),
+        pageSize(_paging.isEnabled() ? _paging.clamp(_lookup_limit) : _lookup_limit),
+        requests(0),
+        handles(0),
+        microseconds(0)
+    {
+    }
+
+    inline ReverseLookupClient::Statistics ReverseLookupClient::getStatistics() const
+    {
+      Statistics ret;
+      ret.requests = requests;
+      ret.handles = handles;
+      ret.time = std::chrono::microseconds(microseconds);
+      ret.pageSize = pageSize;
+      return ret;
+    }
+
+    inline std::vector<std::string> ReverseLookupClient::lookupImpl(const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return requestPage(query, lookup_limit, lookup_page);
+    }
+
+    inline std::vector<std::vector<std::string>>
+    ReverseLookupClient::lookupManyImpl(const std::vector<std::vector<std::pair<std::string, std::string>>> & queries)
     {
+      std::vector<std::vector<std::pair<std::string, std::string>>> unique;
+      std::vector<std::size_t> slot(queries.size());
+      std::map<std::vector<std::pair<std::string, std::string>>, std::size_t> first;
+      for(std::size_t i = 0; i < queries.size(); i++)
+      {
+        auto itr = first.find(queries[i]);
+        if(itr == first.end())
+        {
+          slot[i] = unique.size();
+          first[queries[i]] = unique.size();
+          unique.push_back(queries[i]);
+        }
+        else
+        {
+          slot[i] = itr->second;
+        }
+      }
+      std::vector<std::vector<std::string>> results(unique.size());
+      surfsara::util::parallelFor(unique.size(), lookup_concurrency, [this, &unique, &results](std::size_t i) {
+          results[i] = lookupImpl(unique[i]);
+        });
+      std::vector<std::vector<std::string>> ret(queries.size());
+      for(std::size_t i = 0; i < queries.size(); i++)
+      {
+        ret[i] = results[slot[i]];
+      }
+      return ret;
     }
 
-    inline std::vector<std::string> ReverseLookupClient::lookupImpl(const std::vector<std::pair<std::string, std::string>> & _query)
+    inline bool ReverseLookupClient::lookupRecordsImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                                       std::vector<std::pair<std::string, surfsara::ast::Node>> & records)
+    {
+      if(!retrieve_records)
+      {
+        return false;
+      }
+      // the handles of a reply without records are still the answer of the lookup
+      requestRecordsPage(query, lookup_limit, lookup_page, records);
+      return true;
+    }
+
+    inline bool ReverseLookupClient::lookupRecordsEachImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                                           std::function<bool(const std::string & handle,
+                                                                              const surfsara::ast::Node & values)> func)
+    {
+      if(!retrieve_records || records_ignored)
+      {
+        return false;
+      }
+      std::vector<std::pair<std::string, surfsara::ast::Node>> records;
+      std::string firstOfPrevious;
+      for(std::size_t page = lookup_page; ; page++)
+      {
+        if(!requestRecordsPage(query, lookup_limit, page, records))
+        {
+          // only the first page can tell, the server does not support retrieverecords
+          if(page == lookup_page)
+          {
+            return false;
+          }
+          throw std::logic_error("did not return an object");
+        }
+        if(records.empty() ||
+           (page != lookup_page && records.front().first == firstOfPrevious))
+        {
+          // no more records or the server ignores the page parameter
+          break;
+        }
+        firstOfPrevious = records.front().first;
+        for(auto & record : records)
+        {
+          if(!func(record.first, record.second))
+          {
+            return true;
+          }
+        }
+        if(lookup_limit == 0 || records.size() < lookup_limit)
+        {
+          break;
+        }
+      }
+      return true;
+    }
+
+    inline bool ReverseLookupClient::requestRecordsPage(const std::vector<std::pair<std::string, std::string>> & _query,
+                                                        std::size_t limit,
+                                                        std::size_t page,
+                                                        std::vector<std::pair<std::string, surfsara::ast::Node>> & records)
     {
       using Array = surfsara::ast::Array;
+      using Object = surfsara::ast::Object;
+      using Node = surfsara::ast::Node;
       using String = surfsara::ast::String;
       std::vector<std::pair<std::string, std::string>> query(_query);
-      query.push_back(std::make_pair("limit", std::to_string(lookup_limit)));
-      query.push_back(std::make_pair("page", std::to_string(lookup_page)));
-      std::vector<std::string> ret;
+      query.push_back(std::make_pair("limit", std::to_string(limit)));
+      query.push_back(std::make_pair("page", std::to_string(page)));
+      query.push_back(std::make_pair("retrieverecords", "true"));
       std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> optionsCopy(options);
       optionsCopy.push_back(surfsara::curl::Url(url + "/" + prefix, query));
       surfsara::curl::Curl curl(optionsCopy);
+      auto start = std::chrono::steady_clock::now();
       auto res = curl.request();
+      requests++;
+      microseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
       if(verbose)
       {
+        std::lock_guard<std::mutex> lock(surfsara::util::outputMutex());
         std::cout << res << std::endl;
       }
       if(!surfsara::curl::httpCodeIsSuccess(res.httpCode))
@@ -94,26 +428,171 @@ namespace surfsara
         tmp << res;
         throw std::logic_error(tmp.str());
       }
-
+      // {"PREFIX/SUFFIX": [{"index": 1, "type": ..., "data": ...}, ...], ...}
       auto node = surfsara::ast::parseJson(res.body);
+      records.clear();
       if(node.isA<Array>())
       {
-        node.as<Array>().forEach([&ret](const surfsara::ast::Node & node){
-            if(node.isA<String>())
+        // the server does not support retrieverecords
+        records_ignored = true;
+        node.as<Array>().forEach([&records](const Node & handle) {
+            if(!handle.isA<String>())
             {
-              ret.push_back(node.as<String>());
+              throw std::logic_error("invalid handle in lookup result");
             }
-            else
+            records.push_back(std::make_pair(handle.as<String>(), Node()));
+          });
+        handles += records.size();
+        return false;
+      }
+      else if(!node.isA<Object>())
+      {
+        throw std::logic_error("did not return an object");
+      }
+      node.as<Object>().forEach([&records](const std::string & handle, const Node & values) {
+          if(values.isA<Array>())
+          {
+            records.push_back(std::make_pair(handle, values));
+          }
+          else if(values.isA<Object>() && values.as<Object>().has("values"))
+          {
+            records.push_back(std::make_pair(handle, values.as<Object>()["values"]));
+          }
+          else
+          {
+            throw std::logic_error(std::string("invalid record of ") + handle);
+          }
+        });
+      handles += records.size();
+      return true;
+    }
+
+    inline std::size_t ReverseLookupClient::lookupEachImpl(const std::vector<std::pair<std::string, std::string>> & query,
+                                                           std::function<bool(const std::string & handle)> func)
+    {
+      if(lookup_prefetch > 1 && lookup_limit > 0)
+      {
+        surfsara::util::PagePrefetcher prefetcher([this, query](std::size_t page) {
+            return requestPage(query, lookup_limit, page);
+          },
+          lookup_limit,
+          lookup_prefetch);
+        return prefetcher.forEach(lookup_page, func);
+      }
+      std::size_t n = 0;
+      // pages of an adapted size are addressed by the offset of their first handle
+      std::size_t start = lookup_page * lookup_limit;
+      std::size_t offset = start;
+      std::size_t limit = lookup_limit;
+      if(paging.isEnabled())
+      {
+        limit = pageSize;
+        while(limit > 1 && offset % limit != 0)
+        {
+          limit /= 2;
+        }
+      }
+      std::string firstOfPrevious;
+      while(true)
+      {
+        std::size_t onPage = 0;
+        bool repeated = false;
+        bool stopped = false;
+        auto begin = std::chrono::steady_clock::now();
+        streamPage(query, limit, (limit > 0 ? offset / limit : lookup_page), [&](const std::string & handle) {
+            if(onPage++ == 0)
             {
-              throw std::logic_error("element is not a String");
+              if(offset != start && handle == firstOfPrevious)
+              {
+                // the server ignores the page parameter
+                repeated = true;
+                return false;
+              }
+              firstOfPrevious = handle;
             }
+            n++;
+            stopped = !func(handle);
+            return !stopped;
+          });
+        if(repeated || stopped || onPage == 0 ||
+           limit == 0 || onPage < limit)
+        {
+          break;
+        }
+        offset += limit;
+        if(paging.isEnabled())
+        {
+          auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+          limit = paging.next(limit, onPage, elapsed, offset);
+          pageSize = limit;
+        }
+      }
+      return n;
+    }
+
+    inline std::vector<std::string> ReverseLookupClient::requestPage(const std::vector<std::pair<std::string, std::string>> & query,
+                                                                     std::size_t limit,
+                                                                     std::size_t page)
+    {
+      std::vector<std::string> ret;
+      streamPage(query, limit, page, [&ret](const std::string & handle) {
+          ret.push_back(handle);
+          return true;
         });
+      return ret;
+    }
+
+    inline bool ReverseLookupClient::streamPage(const std::vector<std::pair<std::string, std::string>> & _query,
+                                                std::size_t limit,
+                                                std::size_t page,
+                                                std::function<bool(const std::string & handle)> func)
+    {
+      std::vector<std::pair<std::string, std::string>> query(_query);
+      query.push_back(std::make_pair("limit", std::to_string(limit)));
+      query.push_back(std::make_pair("page", std::to_string(page)));
+      std::vector<std::shared_ptr<surfsara::curl::BasicCurlOpt>> optionsCopy(options);
+      optionsCopy.push_back(surfsara::curl::Url(url + "/" + prefix, query));
+      surfsara::curl::Curl curl(optionsCopy);
+      bool stopped = false;
+      // the body is not kept, verbose output shows the parsed handles
+      surfsara::ast::Array parsed;
+      JsonStringArrayParser parser([this, &func, &stopped, &parsed](const std::string & handle) {
+          if(verbose)
+          {
+            parsed.pushBack(surfsara::ast::String(handle));
+          }
+          stopped = !func(handle);
+          return !stopped;
+        });
+      auto start = std::chrono::steady_clock::now();
+      auto res = curl.request([&parser](const char * data, std::size_t size) {
+          return parser.feed(data, size);
+        });
+      requests++;
+      handles += parser.getCount();
+      microseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+      if(verbose)
+      {
+        std::lock_guard<std::mutex> lock(surfsara::util::outputMutex());
+        std::cout << res << std::endl
+                  << "handles    " << surfsara::ast::formatJson(surfsara::ast::Node(parsed)) << std::endl;
       }
-      else
+      if(stopped)
       {
-        throw std::logic_error("did not return an array");
+        return false;
       }
-      return ret;
+      if(!surfsara::curl::httpCodeIsSuccess(res.httpCode) ||
+         (res.curlCode != CURLE_OK && parser.getError().empty()))
+      {
+        std::stringstream tmp;
+        tmp << res;
+        throw std::logic_error(tmp.str());
+      }
+      if(!parser.finish())
+      {
+        throw std::logic_error(parser.getError());
+      }
+      return true;
     }
   }
 }
@@ -0,0 +1,195 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include "i_handle_client.h"
+#include <surfsara/handle_result.h>
+#include <surfsara/ast.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    /**
+     * Dispatches requests to one handle client per prefix.
+     *
+     * get, update, removeIndices and remove are routed by the prefix of the
+     * handle (the part before the first '/'). create uses the requested
+     * prefix (policy "default") or distributes new handles over all
+     * routed prefixes (policy "round_robin").
+     * Handles of unknown prefixes go to the fallback client, if given.
+     */
+    class RoutingHandleClient : public I_HandleClient
+    {
+    public:
+      enum class CreatePolicy
+      {
+        Default,
+        RoundRobin
+      };
+
+      RoutingHandleClient(const std::map<std::string, std::shared_ptr<I_HandleClient>> & _routes,
+                          CreatePolicy _policy = CreatePolicy::Default,
+                          std::shared_ptr<I_HandleClient> _fallback = nullptr);
+
+      virtual Result create(const std::string & prefix, const surfsara::ast::Node & node) override;
+      virtual Result get(const std::string & handle) override;
+      virtual Result get(const std::string & handle, const std::vector<int> & indices) override;
+      virtual Result get(const std::string & handle, const std::vector<std::string> & types) override;
+      virtual Result update(const std::string & handle, const surfsara::ast::Node & node) override;
+      virtual Result removeIndices(const std::string & handle, const std::vector<int> & indices) override;
+      virtual Result remove(const std::string & handle) override;
+
+      inline std::vector<std::string> getPrefixes() const;
+
+      /**
+       * Parse the name of a create policy: default or round_robin
+       */
+      inline static CreatePolicy parsePolicy(const std::string & name);
+      inline static std::string getPrefix(const std::string & handle);
+
+    private:
+      inline std::shared_ptr<I_HandleClient> route(const std::string & prefix) const;
+
+      std::map<std::string, std::shared_ptr<I_HandleClient>> routes;
+      std::vector<std::string> prefixes;
+      CreatePolicy policy;
+      std::shared_ptr<I_HandleClient> fallback;
+      std::atomic<std::size_t> next;
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <stdexcept>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    inline RoutingHandleClient::RoutingHandleClient(const std::map<std::string, std::shared_ptr<I_HandleClient>> & _routes,
+                                                    CreatePolicy _policy,
+                                                    std::shared_ptr<I_HandleClient> _fallback)
+      : routes(_routes), policy(_policy), fallback(_fallback), next(0)
+    {
+      for(auto & kv : routes)
+      {
+        prefixes.push_back(kv.first);
+      }
+      if(policy == CreatePolicy::RoundRobin && prefixes.empty())
+      {
+        throw std::invalid_argument("round_robin create policy requires at least one route");
+      }
+    }
+
+    inline Result RoutingHandleClient::create(const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      if(policy == CreatePolicy::RoundRobin)
+      {
+        const std::string & selected(prefixes[next++ % prefixes.size()]);
+        return routes.find(selected)->second->create(selected, node);
+      }
+      else
+      {
+        return route(prefix)->create(prefix, node);
+      }
+    }
+
+    inline Result RoutingHandleClient::get(const std::string & handle)
+    {
+      return route(getPrefix(handle))->get(handle);
+    }
+
+    inline Result RoutingHandleClient::get(const std::string & handle, const std::vector<int> & indices)
+    {
+      return route(getPrefix(handle))->get(handle, indices);
+    }
+
+    inline Result RoutingHandleClient::get(const std::string & handle, const std::vector<std::string> & types)
+    {
+      return route(getPrefix(handle))->get(handle, types);
+    }
+
+    inline Result RoutingHandleClient::update(const std::string & handle, const surfsara::ast::Node & node)
+    {
+      return route(getPrefix(handle))->update(handle, node);
+    }
+
+    inline Result RoutingHandleClient::removeIndices(const std::string & handle, const std::vector<int> & indices)
+    {
+      return route(getPrefix(handle))->removeIndices(handle, indices);
+    }
+
+    inline Result RoutingHandleClient::remove(const std::string & handle)
+    {
+      return route(getPrefix(handle))->remove(handle);
+    }
+
+    inline std::vector<std::string> RoutingHandleClient::getPrefixes() const
+    {
+      return prefixes;
+    }
+
+    inline RoutingHandleClient::CreatePolicy RoutingHandleClient::parsePolicy(const std::string & name)
+    {
+      if(name.empty() || name == "default")
+      {
+        return CreatePolicy::Default;
+      }
+      else if(name == "round_robin")
+      {
+        return CreatePolicy::RoundRobin;
+      }
+      else
+      {
+        throw std::invalid_argument(std::string("invalid create policy '") + name +
+                                    "', expected default or round_robin");
+      }
+    }
+
+    inline std::string RoutingHandleClient::getPrefix(const std::string & handle)
+    {
+      return handle.substr(0, handle.find('/'));
+    }
+
+    inline std::shared_ptr<I_HandleClient> RoutingHandleClient::route(const std::string & prefix) const
+    {
+      auto itr = routes.find(prefix);
+      if(itr != routes.end())
+      {
+        return itr->second;
+      }
+      else if(fallback)
+      {
+        return fallback;
+      }
+      else
+      {
+        throw std::invalid_argument(std::string("no handle server configured for prefix '") + prefix + "'");
+      }
+    }
+  }
+}
@@ -19,6 +19,8 @@ limitations under the License.
 #include <string>
 #include <iostream>
 #include <functional>
+#include <mutex>
+#include <cstdint>
 #include <surfsara/ast.h>
 
 namespace surfsara
@@ -32,6 +34,30 @@ namespace surfsara
 
     inline std::string joinPath(const std::string & s1, const std::string & s2);
     inline void replace(std::string & str, const std::string & find, const std::string & substr);
+
+    /**
+     * 64 bit FNV-1a hash, the basis can be varied to derive independent hashes.
+     */
+    inline std::uint64_t fnv1a(const std::string & str,
+                               std::uint64_t basis = 0xcbf29ce484222325ULL);
+
+    /**
+     * Match str against a pattern in which '*' stands for any sequence
+     * of characters, as in the filters of the reverse lookup service.
+     * A backslash escapes the next character.
+     */
+    inline bool globMatch(const std::string & pattern, const std::string & str);
+
+    /**
+     * Escape the wildcard characters ('*', '?', '[') and backslashes of
+     * str, so that it matches itself in a filter of the reverse lookup.
+     */
+    inline std::string escapeGlob(const std::string & str);
+
+    /**
+     * Serializes diagnostic output of concurrent threads.
+     */
+    inline std::mutex & outputMutex();
   }
 }
 
@@ -113,5 +139,74 @@ inline void surfsara::util::replace(std::string & str, const std::string & find,
   }
 }
 
+inline std::uint64_t surfsara::util::fnv1a(const std::string & str, std::uint64_t basis)
+{
+  std::uint64_t h = basis;
+  for(unsigned char c : str)
+  {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+inline bool surfsara::util::globMatch(const std::string & pattern, const std::string & str)
+{
+  // backtrack to the last '*' on mismatch
+  std::size_t p = 0;
+  std::size_t s = 0;
+  std::size_t star = std::string::npos;
+  std::size_t mark = 0;
+  while(s < str.size())
+  {
+    if(p < pattern.size() && pattern[p] == '*')
+    {
+      star = p++;
+      mark = s;
+    }
+    else if(p < pattern.size() && pattern[p] == '\\' && p + 1 < pattern.size() && pattern[p + 1] == str[s])
+    {
+      p += 2;
+      s++;
+    }
+    else if(p < pattern.size() && pattern[p] != '\\' && pattern[p] == str[s])
+    {
+      p++;
+      s++;
+    }
+    else if(star != std::string::npos)
+    {
+      p = star + 1;
+      s = ++mark;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  while(p < pattern.size() && pattern[p] == '*')
+  {
+    p++;
+  }
+  return p == pattern.size();
+}
 
+inline std::string surfsara::util::escapeGlob(const std::string & str)
+{
+  std::string ret;
+  for(char c : str)
+  {
+    if(c == '*' || c == '?' || c == '[' || c == '\\')
+    {
+      ret.push_back('\\');
+    }
+    ret.push_back(c);
+  }
+  return ret;
+}
 
+inline std::mutex & surfsara::util::outputMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
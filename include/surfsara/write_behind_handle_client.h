@@ -0,0 +1,472 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include "i_handle_client.h"
+#include <surfsara/handle_result.h>
+#include <surfsara/ast.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    /**
+     * Failed deferred write.
+     */
+    struct WriteBehindError
+    {
+      std::string handle;
+      std::string operation;
+      std::string message;
+      long httpCode;
+      long handleCode;
+      surfsara::ast::Node values;
+      std::vector<int> indices;
+
+      inline surfsara::ast::Node toNode() const;
+    };
+
+    /**
+     * Write-behind layer in front of a handle client.
+     *
+     * update and removeIndices are buffered per handle for a window and
+     * coalesced into a single DELETE (removed indices) followed by a single
+     * PUT (final values) by a background thread. get overlays the pending
+     * mutations on the record of the inner client.
+     *
+     * Since writes are acknowledged before they reach the server, failures
+     * are reported afterwards: they are appended as JSON lines to the journal
+     * file (if given) and kept until takeErrors is called.
+     * Pending writes are flushed on flush() and in the destructor.
+     */
+    class WriteBehindHandleClient : public I_HandleClient
+    {
+    public:
+      using Clock = std::chrono::steady_clock;
+
+      WriteBehindHandleClient(std::shared_ptr<I_HandleClient> _inner,
+                              std::chrono::milliseconds _window,
+                              const std::string & _journal = "");
+      ~WriteBehindHandleClient();
+
+      virtual Result create(const std::string & prefix, const surfsara::ast::Node & node) override;
+      virtual Result get(const std::string & handle) override;
+      virtual Result get(const std::string & handle, const std::vector<int> & indices) override;
+      virtual Result get(const std::string & handle, const std::vector<std::string> & types) override;
+      virtual Result update(const std::string & handle, const surfsara::ast::Node & node) override;
+      virtual Result removeIndices(const std::string & handle, const std::vector<int> & indices) override;
+      virtual Result remove(const std::string & handle) override;
+
+      /**
+       * Apply the pending writes of handle to a record that has not been
+       * read by this client, e.g. one of the reverse lookup service.
+       */
+      virtual void overlay(const std::string & handle, Result & res) override;
+
+      /**
+       * Send all pending writes now.
+       * @return number of failed writes
+       */
+      inline std::size_t flush();
+
+      inline std::size_t pendingSize();
+      inline std::vector<WriteBehindError> takeErrors();
+
+    private:
+      struct Pending
+      {
+        surfsara::ast::Node values;
+        std::set<int> removed;
+        Clock::time_point due;
+      };
+
+      inline Result accepted(const std::string & handle) const;
+      inline std::size_t flushPending(bool all);
+      inline void flushHandle(const std::string & handle);
+      inline std::size_t send(const std::string & handle, const Pending & pending);
+      inline void reportError(const WriteBehindError & error);
+      inline void run();
+      inline static surfsara::ast::Node emptyValues();
+
+      std::shared_ptr<I_HandleClient> inner;
+      std::chrono::milliseconds window;
+      std::string journal;
+
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::map<std::string, Pending> pending;
+      // taken from pending, not yet confirmed by the server
+      std::map<std::string, Pending> inFlight;
+      std::vector<WriteBehindError> errors;
+      bool stopped;
+
+      // serializes flushes, so that writes of a handle are sent in order
+      std::mutex flushMutex;
+      std::thread worker;
+    };
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+///////////////////////////////////////////////////////////////////////////////////////
+#include <fstream>
+#include <iostream>
+#include <surfsara/handle_util.h>
+#include <surfsara/json_format.h>
+#include <surfsara/util.h>
+
+namespace surfsara
+{
+  namespace handle
+  {
+    inline surfsara::ast::Node WriteBehindError::toNode() const
+    {
+      using Object = surfsara::ast::Object;
+      using Array = surfsara::ast::Array;
+      using Integer = surfsara::ast::Integer;
+      using String = surfsara::ast::String;
+      Array idx;
+      for(auto i : indices)
+      {
+        idx.pushBack(Integer(i));
+      }
+      Object obj;
+      obj.set("handle", String(handle));
+      obj.set("operation", String(operation));
+      obj.set("message", String(message));
+      obj.set("httpCode", Integer(httpCode));
+      obj.set("responseCode", Integer(handleCode));
+      obj.set("values", values);
+      obj.set("indices", idx);
+      return obj;
+    }
+
+    inline WriteBehindHandleClient::WriteBehindHandleClient(std::shared_ptr<I_HandleClient> _inner,
+                                                            std::chrono::milliseconds _window,
+                                                            const std::string & _journal)
+      : inner(_inner), window(_window), journal(_journal), stopped(false)
+    {
+      worker = std::thread(&WriteBehindHandleClient::run, this);
+    }
+
+    inline WriteBehindHandleClient::~WriteBehindHandleClient()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+      }
+      cond.notify_all();
+      worker.join();
+      flushPending(true);
+      std::lock_guard<std::mutex> lock(mutex);
+      if(journal.empty() && !errors.empty())
+      {
+        // nobody will collect them anymore
+        std::lock_guard<std::mutex> outputLock(surfsara::util::outputMutex());
+        for(auto & err : errors)
+        {
+          std::cerr << "write-behind " << err.operation << " of " << err.handle
+                    << " failed: " << err.message << std::endl;
+        }
+      }
+    }
+
+    inline Result WriteBehindHandleClient::create(const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      return inner->create(prefix, node);
+    }
+
+    inline Result WriteBehindHandleClient::get(const std::string & handle)
+    {
+      Result res = inner->get(handle);
+      if(res.success)
+      {
+        overlay(handle, res);
+      }
+      return res;
+    }
+
+    inline Result WriteBehindHandleClient::get(const std::string & handle, const std::vector<int> & indices)
+    {
+      // the server filters, so it has to see the pending writes
+      flushHandle(handle);
+      return inner->get(handle, indices);
+    }
+
+    inline Result WriteBehindHandleClient::get(const std::string & handle, const std::vector<std::string> & types)
+    {
+      flushHandle(handle);
+      return inner->get(handle, types);
+    }
+
+    inline Result WriteBehindHandleClient::update(const std::string & handle, const surfsara::ast::Node & node)
+    {
+      std::vector<int> indices = getIndices(node);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = pending.find(handle);
+        if(itr == pending.end())
+        {
+          itr = pending.insert(std::make_pair(handle, Pending{emptyValues(), {}, Clock::now() + window})).first;
+        }
+        mergeValues(itr->second.values, node);
+        // the PUT recreates entries removed before
+        for(auto i : indices)
+        {
+          itr->second.removed.erase(i);
+        }
+      }
+      cond.notify_all();
+      return accepted(handle);
+    }
+
+    inline Result WriteBehindHandleClient::removeIndices(const std::string & handle, const std::vector<int> & indices)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = pending.find(handle);
+        if(itr == pending.end())
+        {
+          itr = pending.insert(std::make_pair(handle, Pending{emptyValues(), {}, Clock::now() + window})).first;
+        }
+        removeValues(itr->second.values, indices);
+        itr->second.removed.insert(indices.begin(), indices.end());
+      }
+      cond.notify_all();
+      return accepted(handle);
+    }
+
+    inline Result WriteBehindHandleClient::remove(const std::string & handle)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(handle);
+      }
+      // wait for a write of this handle that is in flight
+      std::lock_guard<std::mutex> lock(flushMutex);
+      return inner->remove(handle);
+    }
+
+    inline std::size_t WriteBehindHandleClient::flush()
+    {
+      return flushPending(true);
+    }
+
+    inline std::size_t WriteBehindHandleClient::pendingSize()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return pending.size();
+    }
+
+    inline std::vector<WriteBehindError> WriteBehindHandleClient::takeErrors()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<WriteBehindError> ret;
+      ret.swap(errors);
+      return ret;
+    }
+
+    inline Result WriteBehindHandleClient::accepted(const std::string & handle) const
+    {
+      Result res;
+      res.handle = handle;
+      res.handleCode = 1;
+      res.success = true;
+      return res;
+    }
+
+    inline void WriteBehindHandleClient::overlay(const std::string & handle, Result & res)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(auto * m : {&inFlight, &pending})
+      {
+        auto itr = m->find(handle);
+        if(itr != m->end())
+        {
+          surfsara::ast::Node & data(res.data);
+          removeValues(data, std::vector<int>(itr->second.removed.begin(), itr->second.removed.end()));
+          mergeValues(data, itr->second.values);
+        }
+      }
+    }
+
+    inline std::size_t WriteBehindHandleClient::flushPending(bool all)
+    {
+      std::lock_guard<std::mutex> flushLock(flushMutex);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = Clock::now();
+        for(auto itr = pending.begin(); itr != pending.end();)
+        {
+          if(all || itr->second.due <= now)
+          {
+            inFlight.insert(*itr);
+            itr = pending.erase(itr);
+          }
+          else
+          {
+            ++itr;
+          }
+        }
+      }
+      std::size_t failed = 0;
+      while(true)
+      {
+        std::pair<std::string, Pending> next;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if(inFlight.empty())
+          {
+            break;
+          }
+          next = *inFlight.begin();
+        }
+        failed += send(next.first, next.second);
+        std::lock_guard<std::mutex> lock(mutex);
+        inFlight.erase(next.first);
+      }
+      return failed;
+    }
+
+    inline void WriteBehindHandleClient::flushHandle(const std::string & handle)
+    {
+      // no write is in flight while the flush lock is held
+      std::lock_guard<std::mutex> flushLock(flushMutex);
+      std::pair<std::string, Pending> next;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto itr = pending.find(handle);
+        if(itr == pending.end())
+        {
+          return;
+        }
+        next = *itr;
+        inFlight.insert(*itr);
+        pending.erase(itr);
+      }
+      // failures are collected by takeErrors
+      send(next.first, next.second);
+      std::lock_guard<std::mutex> lock(mutex);
+      inFlight.erase(handle);
+    }
+
+    inline std::size_t WriteBehindHandleClient::send(const std::string & handle, const Pending & p)
+    {
+      std::size_t failed = 0;
+      std::vector<int> removed(p.removed.begin(), p.removed.end());
+      std::vector<std::pair<std::string, std::function<Result()>>> requests;
+      if(!removed.empty())
+      {
+        requests.push_back(std::make_pair(std::string("removeIndices"), [this, &handle, &removed]() {
+              return inner->removeIndices(handle, removed);
+            }));
+      }
+      if(getIndexArray(p.values).size() > 0)
+      {
+        requests.push_back(std::make_pair(std::string("update"), [this, &handle, &p]() {
+              return inner->update(handle, p.values);
+            }));
+      }
+      for(auto & req : requests)
+      {
+        WriteBehindError err{handle, req.first, "", 0, 0, p.values, removed};
+        try
+        {
+          Result res = req.second();
+          if(res.success)
+          {
+            continue;
+          }
+          err.httpCode = res.curlResult.httpCode;
+          err.handleCode = res.handleCode;
+          err.message = std::string("request failed: ") + responseCode2string(res.handleCode);
+        }
+        catch(std::exception & ex)
+        {
+          err.message = ex.what();
+        }
+        reportError(err);
+        failed++;
+      }
+      return failed;
+    }
+
+    inline void WriteBehindHandleClient::reportError(const WriteBehindError & error)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!journal.empty())
+      {
+        std::ofstream ost(journal, std::ios::app);
+        ost << surfsara::ast::formatJson(error.toNode()) << std::endl;
+        if(!ost)
+        {
+          std::lock_guard<std::mutex> outputLock(surfsara::util::outputMutex());
+          std::cerr << "could not write to journal " << journal << std::endl;
+        }
+      }
+      errors.push_back(error);
+    }
+
+    inline void WriteBehindHandleClient::run()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while(!stopped)
+      {
+        if(pending.empty())
+        {
+          cond.wait(lock);
+          continue;
+        }
+        auto due = pending.begin()->second.due;
+        for(auto & p : pending)
+        {
+          if(p.second.due < due)
+          {
+            due = p.second.due;
+          }
+        }
+        if(Clock::now() < due)
+        {
+          cond.wait_until(lock, due);
+          continue;
+        }
+        lock.unlock();
+        flushPending(false);
+        lock.lock();
+      }
+    }
+
+    inline surfsara::ast::Node WriteBehindHandleClient::emptyValues()
+    {
+      surfsara::ast::Object obj;
+      obj.set("values", surfsara::ast::Array());
+      return obj;
+    }
+  }
+}
@@ -42,6 +42,21 @@ using Node = surfsara::ast::Node;
 inline int finalize(const Config & config, const surfsara::handle::Result & res);
 inline bool checkLookupParameters(const Config & config);
 
+/**
+ * Call func with each non-empty line of file (- for stdin).
+ */
+inline std::size_t forEachLine(const std::string & file,
+                               std::function<void(const std::string & line)> func);
+
+/**
+ * Call func with the value of lookup_key of every handle that has one.
+ * Values come with the records if the lookup service returns them,
+ * otherwise they are fetched with bounded concurrency (handle_concurrency).
+ */
+inline std::size_t scanLookupValues(const Config & config,
+                                    std::function<void(const std::string & value,
+                                                       const std::string & handle)> func);
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Create
@@ -65,7 +80,7 @@ public:
   
   virtual int exec(Config & config) override
   {
-    auto client = config.makeHandleClient();
+    auto client = config.makeRoutedHandleClient();
     surfsara::handle::Result res;
     Node node(surfsara::ast::parseJson(config.args->getValue().front()));
     if(config.verbose->isSet())
@@ -99,7 +114,7 @@ public:
 
   virtual int exec(Config & config) override
   {
-    auto client = config.makeHandleClient();
+    auto client = config.makeRoutedHandleClient();
     surfsara::handle::Result res;
     res = client->get(config.args->getValue().front());
     return finalize(config, res);
@@ -129,7 +144,7 @@ public:
   
   virtual int exec(Config & config) override
   {
-    auto client = config.makeHandleClient();
+    auto client = config.makeRoutedHandleClient();
     surfsara::handle::Result res;
     Node node(surfsara::ast::parseJson(config.args->getValue()[1]));
     res = client->update(config.args->getValue().front(), node);
@@ -180,7 +195,7 @@ public:
 
   virtual int exec(Config & config) override
   {
-    auto reverseLookupClient = config.makeReverseLookupClient();
+    auto reverseLookupClient = config.makeLookupClient();
     std::vector<std::pair<std::string, std::string>> query;
     for(auto arg : config.args->getValue())
     {
@@ -193,11 +208,12 @@ public:
     }
     try
     {
-      auto res = reverseLookupClient->lookup(query);
-      for(auto handle : res)
-      {
-        std::cout << handle << std::endl;
-      }
+      // stream all pages
+      reverseLookupClient->lookupEach(query, [](const std::string & handle) {
+          std::cout << handle << "\n";
+          return static_cast<bool>(std::cout);
+        });
+      std::cout.flush();
       return 0;
     }
     catch(const std::exception & ex)
@@ -232,7 +248,7 @@ public:
   {
     std::vector<std::string> values = config.args->getValue();
     std::string handle = values.front();
-    auto client = config.makeHandleClient();
+    auto client = config.makeRoutedHandleClient();
     values.erase(values.begin());
     std::vector<int> indices;
     for(auto arg : values)
@@ -266,7 +282,7 @@ public:
   
   virtual int exec(Config & config) override
   {
-    auto client = config.makeHandleClient();
+    auto client = config.makeRoutedHandleClient();
     std::string handle = config.args->getValue().front();
     auto res = client->remove(handle);
     return finalize(config, res);
@@ -310,6 +326,88 @@ public:
   }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Create IRods Objects in bulk
+//
+////////////////////////////////////////////////////////////////////////////////
+class HandleCreateIRodsObjects : public Operation
+{
+public:
+  HandleCreateIRodsObjects() : Operation("icreate_bulk",
+                                         "icreate_bulk <FILE> [<KEY> <VALUE> ...]: create PIDs for the irods objects in FILE (one path per line, - for stdin),\n"
+                                         "                                          print one JSON line per path\n") {}
+  virtual int parse(Config & config) override
+  {
+    if(config.args->getValue().size() < 1 ||
+       (config.args->getValue().size() - 1) % 2 != 0)
+    {
+      std::cerr << "arguments required: "
+                << "1. file of irods paths,"
+                << "2. key value pairs" << std::endl;
+      return 8;
+    }
+    return 0;
+  }
+
+  virtual int exec(Config & config) override
+  {
+    // lookups and creates are sent per batch, the output follows the input order
+    const std::size_t batchSize = 1000;
+    auto client = config.makeIRodsHandleClient();
+    auto args = config.args->getValue();
+    auto kvpairs = listToPairs(args.begin() + 1, args.end());
+    std::size_t concurrency = (config.handle_concurrency->isSet() ? config.handle_concurrency->getValue() : 8);
+    std::size_t failed = 0;
+    std::vector<std::string> batch;
+    auto flush = [&]() {
+      for(auto & r : client->createMany(batch, kvpairs, concurrency))
+      {
+        surfsara::ast::Object line{{"path", r.path}};
+        if(r.error.empty() && r.result.success)
+        {
+          line.set("success", surfsara::ast::Boolean(true));
+          line.set("handle", r.result.handle);
+        }
+        else
+        {
+          failed++;
+          line.set("success", surfsara::ast::Boolean(false));
+          if(r.error.empty())
+          {
+            line.set("httpCode", surfsara::ast::Integer(r.result.curlResult.httpCode));
+            line.set("handleCode", surfsara::ast::Integer(r.result.handleCode));
+          }
+          else
+          {
+            line.set("error", r.error);
+          }
+        }
+        std::cout << surfsara::ast::formatJson(line) << "\n";
+      }
+      std::cout.flush();
+      batch.clear();
+    };
+    try
+    {
+      forEachLine(args.front(), [&](const std::string & path) {
+          batch.push_back(path);
+          if(batch.size() >= batchSize)
+          {
+            flush();
+          }
+        });
+      flush();
+    }
+    catch(const std::exception & ex)
+    {
+      std::cerr << ex.what() << std::endl;
+      return 8;
+    }
+    return (failed ? 8 : 0);
+  }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Move IRods Object
@@ -338,6 +436,73 @@ public:
   }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Move IRods Collection
+//
+////////////////////////////////////////////////////////////////////////////////
+class HandleMoveIRodsCollection : public Operation
+{
+public:
+  HandleMoveIRodsCollection(): Operation("imove_collection",
+                                         "imove_collection <OLD_PATH> <NEW_PATH>: move PIDs of all irods objects below a collection\n") {}
+  virtual int parse(Config & config) override
+  {
+    if(config.args->getValue().size() != 2)
+    {
+      std::cerr << "exactly two arguments (irods old collection / new collection) required for move operation" << std::endl;
+      return 8;
+    }
+    return 0;
+  }
+
+  virtual int exec(Config & config) override
+  {
+    using MoveResult = surfsara::handle::IRodsHandleClient::MoveResult;
+    auto client = config.makeIRodsHandleClient();
+    std::size_t concurrency = (config.handle_concurrency->isSet() ? config.handle_concurrency->getValue() : 8);
+    std::size_t failed = 0;
+    bool verbose = config.verbose->isSet();
+    try
+    {
+      auto results = client->moveCollection(config.args->getValue()[0],
+                                            config.args->getValue()[1],
+                                            concurrency,
+                                            [&failed, verbose](const MoveResult & r, std::size_t done, std::size_t total) {
+                                              if(!r.error.empty() || !r.result.success)
+                                              {
+                                                failed++;
+                                                std::cerr << "failed to move " << r.handle << " " << r.oldPath << ": ";
+                                                if(r.error.empty())
+                                                {
+                                                  std::cerr << r.result << std::endl;
+                                                }
+                                                else
+                                                {
+                                                  std::cerr << r.error << std::endl;
+                                                }
+                                              }
+                                              else if(verbose)
+                                              {
+                                                std::cout << r.handle << " " << r.oldPath << " -> " << r.newPath << std::endl;
+                                              }
+                                              if(done % 100 == 0 || done == total)
+                                              {
+                                                std::cerr << "processed " << done << "/" << total << std::endl;
+                                              }
+                                            });
+      std::cout << "moved " << (results.size() - failed) << " handles, "
+                << failed << " failed" << std::endl;
+    }
+    catch(const std::exception & ex)
+    {
+      std::cerr << ex.what() << std::endl;
+      return 8;
+    }
+    return (failed ? 8 : 0);
+  }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Delete IRods Object
@@ -366,6 +531,74 @@ public:
   }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Delete IRods Collection
+//
+////////////////////////////////////////////////////////////////////////////////
+class HandleDeleteIRodsCollection : public Operation
+{
+public:
+  HandleDeleteIRodsCollection(): Operation("idelete_collection",
+                                           "idelete_collection <PATH>: remove PIDs of all irods objects below a collection\n") {}
+  virtual int parse(Config & config) override
+  {
+    if(config.args->getValue().size() != 1)
+    {
+      std::cerr << "exactly one argument (irods collection) required for delete operation" << std::endl;
+      return 8;
+    }
+    return 0;
+  }
+
+  virtual int exec(Config & config) override
+  {
+    using RemoveResult = surfsara::handle::IRodsHandleClient::RemoveResult;
+    auto client = config.makeIRodsHandleClient();
+    std::size_t concurrency = (config.handle_concurrency->isSet() ? config.handle_concurrency->getValue() : 8);
+    long rate = (config.handle_rate_limit->isSet() ? config.handle_rate_limit->getValue() : 0);
+    bool verbose = config.verbose->isSet();
+    try
+    {
+      auto summary = client->removeCollection(config.args->getValue()[0],
+                                              concurrency,
+                                              double(rate),
+                                              [verbose](const RemoveResult & r, std::size_t done, std::size_t total) {
+                                                if(r.skipped)
+                                                {
+                                                  std::cerr << "skipped " << r.handle << ": " << r.error << std::endl;
+                                                }
+                                                else if(!r.error.empty())
+                                                {
+                                                  std::cerr << "failed to remove " << r.handle << ": " << r.error << std::endl;
+                                                }
+                                                else if(!r.result.success && !r.missing)
+                                                {
+                                                  std::cerr << "failed to remove " << r.handle << ": " << r.result << std::endl;
+                                                }
+                                                else if(verbose)
+                                                {
+                                                  std::cout << r.handle << (r.missing ? " missing" : " deleted") << std::endl;
+                                                }
+                                                if(done % 100 == 0 || done == total)
+                                                {
+                                                  std::cerr << "processed " << done << "/" << total << std::endl;
+                                                }
+                                              });
+      std::cout << "deleted " << summary.deleted << " handles, "
+                << summary.missing << " missing, "
+                << summary.skipped << " skipped, "
+                << summary.failed << " failed" << std::endl;
+      return (summary.failed ? 8 : 0);
+    }
+    catch(const std::exception & ex)
+    {
+      std::cerr << ex.what() << std::endl;
+      return 8;
+    }
+  }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Get IRods Object
@@ -391,16 +624,25 @@ public:
   virtual int exec(Config & config) override
   {
     auto client = config.makeIRodsHandleClient();
+    if(config.args->getValue().size() == 2)
+    {
+      // only fetch the requested type
+      std::string type(config.args->getValue()[1]);
+      auto res = client->get(config.args->getValue()[0], std::vector<std::string>{type});
+      if(!res.success)
+      {
+        std::cerr << res << std::endl;
+        return 8;
+      }
+      std::cout << surfsara::handle::extractValueByType(res.data, type) << std::endl;
+      return 0;
+    }
     auto res = client->get(config.args->getValue()[0]);
     if(!res.success)
     {
       std::cerr << res << std::endl;
       return 8;
     }
-    else if(config.args->getValue().size() == 2)
-    {
-      std::cout << surfsara::handle::extractValueByType(res.data, config.args->getValue()[1]) << std::endl;
-    }
     else
     {
       return finalize(config, res);
@@ -495,6 +737,140 @@ public:
 
 };
   
+////////////////////////////////////////////////////////////////////////////////
+//
+// Build Bloom Filter
+//
+////////////////////////////////////////////////////////////////////////////////
+class BloomBuild : public Operation
+{
+public:
+  BloomBuild() : Operation("bloom_build",
+                           "bloom_build: add all values of lookup_key found by reverse lookup to lookup_bloom_filter\n"
+                           "bloom_build <FILE>: add the lookup values in FILE (one per line, - for stdin) to lookup_bloom_filter\n") {}
+
+  virtual int parse(Config & config) override
+  {
+    if(!config.lookup_bloom_filter->isSet())
+    {
+      std::cerr << "required argument --lookup_bloom_filter" << std::endl;
+      return 8;
+    }
+    if(config.args->getValue().size() > 1)
+    {
+      std::cerr << "at most one argument (file) expected" << std::endl;
+      return 8;
+    }
+    if(config.args->getValue().empty())
+    {
+      if(!checkLookupParameters(config))
+      {
+        return 8;
+      }
+      if(config.lookup_key->getValue().empty())
+      {
+        std::cerr << "required argument --lookup_key" << std::endl;
+        return 8;
+      }
+    }
+    return 0;
+  }
+
+  virtual int exec(Config & config) override
+  {
+    auto filter = config.makeBloomFilter();
+    std::size_t n = 0;
+    try
+    {
+      if(config.args->getValue().empty())
+      {
+        n = scanLookupValues(config, [&filter](const std::string & value, const std::string & handle) {
+            filter->add(value);
+          });
+      }
+      else
+      {
+        n = forEachLine(config.args->getValue().front(), [&filter](const std::string & line) {
+            filter->add(line);
+          });
+      }
+      // negative answers are only given from now on
+      filter->setComplete();
+      filter->sync();
+    }
+    catch(const std::exception & ex)
+    {
+      std::cerr << ex.what() << std::endl;
+      return 8;
+    }
+    std::cout << "added " << n << " values, "
+              << filter->getCount() << " values in filter of "
+              << filter->getBits() << " bits" << std::endl;
+    return 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Rebuild Path Index
+//
+////////////////////////////////////////////////////////////////////////////////
+class IndexRebuild : public Operation
+{
+public:
+  IndexRebuild() : Operation("index_rebuild",
+                             "index_rebuild: replace the entries of irods_path_index by the handles found by reverse lookup\n") {}
+
+  virtual int parse(Config & config) override
+  {
+    if(!config.irods_path_index->isSet())
+    {
+      std::cerr << "required argument --irods_path_index" << std::endl;
+      return 8;
+    }
+    if(config.args->getValue().size() != 0)
+    {
+      std::cerr << "no argument expcected" << std::endl;
+      return 8;
+    }
+    if(!checkLookupParameters(config))
+    {
+      return 8;
+    }
+    if(config.lookup_key->getValue().empty())
+    {
+      std::cerr << "required argument --lookup_key" << std::endl;
+      return 8;
+    }
+    return 0;
+  }
+
+  virtual int exec(Config & config) override
+  {
+    auto index = config.makePathIndex();
+    std::size_t n = 0;
+    std::size_t skipped = 0;
+    try
+    {
+      index->clear();
+      n = scanLookupValues(config, [&index, &skipped](const std::string & value, const std::string & handle) {
+          if(!index->put(value, handle))
+          {
+            skipped++;
+          }
+        });
+    }
+    catch(const std::exception & ex)
+    {
+      std::cerr << ex.what() << std::endl;
+      return 8;
+    }
+    std::cout << "indexed " << (n - skipped) << " of " << n << " handles in "
+              << index->capacity() << " slots" << std::endl;
+    return skipped == 0 ? 0 : 8;
+  }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Show Default Profile
@@ -537,8 +913,8 @@ int finalize(const Config & config, const surfsara::handle::Result & res)
   {
     std::cout << res << std::endl;
   }
-  auto result = surfsara::ast::parseJson(res.curlResult.body);
-  auto jsonString = surfsara::ast::formatJson(result, true);
+  // decoded at most once, GET responses are already decoded
+  auto jsonString = surfsara::ast::formatJson(res.data.get(), true);
   if(config.output->isSet())
   {
     std::ofstream ofs(config.output->getValue().c_str(), std::ofstream::out);
@@ -565,10 +941,89 @@ inline bool checkLookupParameters(const Config & config)
   return ok;
 }
 
+inline std::size_t forEachLine(const std::string & file,
+                               std::function<void(const std::string & line)> func)
+{
+  std::ifstream ifs;
+  if(file != "-")
+  {
+    ifs.open(file.c_str());
+    if(!ifs.good())
+    {
+      throw std::runtime_error(std::string("failed to read ") + file);
+    }
+  }
+  std::istream & ist(file == "-" ? std::cin : ifs);
+  std::string line;
+  std::size_t n = 0;
+  while(std::getline(ist, line))
+  {
+    if(!line.empty())
+    {
+      func(line);
+      n++;
+    }
+  }
+  return n;
+}
+
+inline std::size_t scanLookupValues(const Config & config,
+                                    std::function<void(const std::string & value,
+                                                       const std::string & handle)> func)
+{
+  using Object = surfsara::ast::Object;
+  std::string type(config.lookup_key->getValue());
+  auto reverseLookupClient = config.makeReverseLookupClient();
+  std::size_t n = 0;
+  if(reverseLookupClient->lookupRecordsEach({{type, "*"}}, [&](const std::string & handle, const Node & values) {
+        func(surfsara::handle::extractValueByType(Object{{"values", values}}, type), handle);
+        n++;
+        return true;
+      }))
+  {
+    return n;
+  }
+
+  // the lookup service only returns handles, their values are fetched
+  // concurrently in batches, func is called on this thread
+  const std::size_t batchSize = 1000;
+  auto handleClient = config.makeRoutedHandleClient();
+  std::size_t concurrency = (config.handle_concurrency->isSet() ? config.handle_concurrency->getValue() : 8);
+  std::vector<std::string> batch;
+  auto flush = [&]() {
+    std::vector<std::string> values(batch.size());
+    surfsara::util::parallelFor(batch.size(), concurrency, [&](std::size_t i) {
+        auto res = handleClient->get(batch[i], std::vector<std::string>{type});
+        if(!res.success)
+        {
+          throw std::runtime_error(std::string("failed to get ") + batch[i]);
+        }
+        values[i] = surfsara::handle::extractValueByType(res.data, type);
+      });
+    for(std::size_t i = 0; i < batch.size(); i++)
+    {
+      func(values[i], batch[i]);
+    }
+    n += batch.size();
+    batch.clear();
+  };
+  reverseLookupClient->lookupEach({{type, "*"}}, [&](const std::string & handle) {
+      batch.push_back(handle);
+      if(batch.size() >= batchSize)
+      {
+        flush();
+      }
+      return true;
+    });
+  flush();
+  return n;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, const char ** argv)
 {
+  surfsara::curl::GlobalInit curlInit;
   surfsara::handle::Config cfg({
       std::make_shared<HandleCreate>(),
       std::make_shared<HandleGet>(),
@@ -578,12 +1033,17 @@ int main(int argc, const char ** argv)
       std::make_shared<HandleDelete>(),
       std::make_shared<HandleDeletePid>(),
       std::make_shared<HandleCreateIRodsObject>(),
+      std::make_shared<HandleCreateIRodsObjects>(),
       std::make_shared<HandleMoveIRodsObject>(),
+      std::make_shared<HandleMoveIRodsCollection>(),
       std::make_shared<HandleDeleteIRodsObject>(),
+      std::make_shared<HandleDeleteIRodsCollection>(),
       std::make_shared<HandleGetIRodsObject>(),
       std::make_shared<HandleSetIRodsMetaData>(),
       std::make_shared<HandleUnsetIRodsMetaData>(),
       std::make_shared<OverlayConfig>(),
+      std::make_shared<BloomBuild>(),
+      std::make_shared<IndexRebuild>(),
       std::make_shared<ShowDefaultProfile>()});
   
   auto op = cfg.parseArgs(argc, argv);
@@ -606,7 +1066,12 @@ int main(int argc, const char ** argv)
   }
   else
   {
-    return op->exec(cfg);
+    ret = op->exec(cfg);
+    if(cfg.flushWriteBehind() > 0 && ret == 0)
+    {
+      return 8;
+    }
+    return ret;
   }
   return 0;
 }
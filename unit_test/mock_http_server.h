@@ -0,0 +1,362 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+struct HttpRequest
+{
+  std::string method;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> query;
+  // lower case names
+  std::map<std::string, std::string> headers;
+  std::string body;
+
+  inline std::string getHeader(const std::string & name) const;
+};
+
+struct HttpResponse
+{
+  HttpResponse(int _status = 200, const std::string & _body = "") : status(_status), body(_body) {}
+  int status;
+  std::map<std::string, std::string> headers;
+  std::string body;
+};
+
+/**
+ * HTTP/1.1 server on a free port of 127.0.0.1 that runs in the test
+ * process, so that the clients can be tested with their real curl
+ * transport. Connections are kept alive and served by a thread each,
+ * calls of the handler are serialized.
+ */
+class MockHttpServer
+{
+public:
+  using Handler = std::function<HttpResponse(const HttpRequest & request)>;
+
+  MockHttpServer(Handler _handler);
+  ~MockHttpServer();
+  MockHttpServer(const MockHttpServer&) = delete;
+  MockHttpServer & operator=(const MockHttpServer&) = delete;
+
+  /**
+   * http://127.0.0.1:PORT
+   */
+  inline std::string getUrl() const;
+  inline std::size_t getConnections() const;
+  inline std::size_t getRequests() const;
+
+private:
+  inline void acceptLoop();
+  inline void serve(int fd);
+  inline bool readRequest(int fd, std::string & buffer, HttpRequest & request);
+  inline static bool sendAll(int fd, const std::string & data);
+  inline static std::string decode(const std::string & str);
+  inline static const char * reason(int status);
+
+  Handler handler;
+  int listenFd;
+  int port;
+  std::atomic<bool> stopped;
+  std::atomic<std::size_t> connections;
+  std::atomic<std::size_t> requests;
+  std::mutex handlerMutex;
+  std::mutex mutex;
+  std::vector<int> fds;
+  std::vector<std::thread> threads;
+  std::thread acceptThread;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+inline std::string HttpRequest::getHeader(const std::string & name) const
+{
+  auto itr = headers.find(name);
+  return (itr == headers.end() ? std::string() : itr->second);
+}
+
+inline MockHttpServer::MockHttpServer(Handler _handler)
+  : handler(_handler), listenFd(-1), port(0), stopped(false), connections(0), requests(0)
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if(listenFd < 0)
+  {
+    throw std::runtime_error("could not create socket");
+  }
+  int on = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr;
+  std::fill(reinterpret_cast<char*>(&addr), reinterpret_cast<char*>(&addr) + sizeof(addr), 0);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  if(bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+     listen(listenFd, 64) != 0 ||
+     getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+  {
+    close(listenFd);
+    throw std::runtime_error("could not listen on 127.0.0.1");
+  }
+  port = ntohs(addr.sin_port);
+  acceptThread = std::thread([this]() { acceptLoop(); });
+}
+
+inline MockHttpServer::~MockHttpServer()
+{
+  stopped = true;
+  shutdown(listenFd, SHUT_RDWR);
+  acceptThread.join();
+  close(listenFd);
+  {
+    // unblock the connection threads, the descriptors are closed after join
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int fd : fds)
+    {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+  for(int fd : fds)
+  {
+    close(fd);
+  }
+}
+
+inline std::string MockHttpServer::getUrl() const
+{
+  return std::string("http://127.0.0.1:") + std::to_string(port);
+}
+
+inline std::size_t MockHttpServer::getConnections() const
+{
+  return connections;
+}
+
+inline std::size_t MockHttpServer::getRequests() const
+{
+  return requests;
+}
+
+inline void MockHttpServer::acceptLoop()
+{
+  while(!stopped)
+  {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0)
+    {
+      if(stopped)
+      {
+        break;
+      }
+      continue;
+    }
+    connections++;
+    std::lock_guard<std::mutex> lock(mutex);
+    if(stopped)
+    {
+      shutdown(fd, SHUT_RDWR);
+    }
+    fds.push_back(fd);
+    threads.push_back(std::thread([this, fd]() { serve(fd); }));
+  }
+}
+
+inline void MockHttpServer::serve(int fd)
+{
+  std::string buffer;
+  HttpRequest request;
+  while(readRequest(fd, buffer, request))
+  {
+    requests++;
+    HttpResponse response;
+    {
+      std::lock_guard<std::mutex> lock(handlerMutex);
+      response = handler(request);
+    }
+    std::string data = std::string("HTTP/1.1 ") + std::to_string(response.status) + " " + reason(response.status) + "\r\n";
+    for(auto & header : response.headers)
+    {
+      data += header.first + ": " + header.second + "\r\n";
+    }
+    if(response.status != 304)
+    {
+      if(response.headers.find("Content-Type") == response.headers.end())
+      {
+        data += "Content-Type: application/json\r\n";
+      }
+      data += "Content-Length: " + std::to_string(response.body.size()) + "\r\n\r\n" + response.body;
+    }
+    else
+    {
+      data += "\r\n";
+    }
+    if(!sendAll(fd, data) || request.getHeader("connection") == "close")
+    {
+      break;
+    }
+  }
+  shutdown(fd, SHUT_RDWR);
+}
+
+inline bool MockHttpServer::readRequest(int fd, std::string & buffer, HttpRequest & request)
+{
+  char chunk[4096];
+  std::size_t end;
+  while((end = buffer.find("\r\n\r\n")) == std::string::npos)
+  {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if(n <= 0)
+    {
+      return false;
+    }
+    buffer.append(chunk, chunk + n);
+  }
+  request = HttpRequest();
+  std::size_t pos = buffer.find("\r\n");
+  std::string line = buffer.substr(0, pos);
+  std::size_t sp1 = line.find(' ');
+  std::size_t sp2 = line.find(' ', sp1 + 1);
+  if(sp1 == std::string::npos || sp2 == std::string::npos)
+  {
+    return false;
+  }
+  request.method = line.substr(0, sp1);
+  std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  std::size_t q = target.find('?');
+  request.path = decode(target.substr(0, q));
+  if(q != std::string::npos)
+  {
+    std::string query = target.substr(q + 1);
+    std::size_t begin = 0;
+    while(begin <= query.size())
+    {
+      std::size_t amp = query.find('&', begin);
+      std::string param = query.substr(begin, amp == std::string::npos ? std::string::npos : amp - begin);
+      std::size_t eq = param.find('=');
+      if(!param.empty())
+      {
+        request.query.push_back(std::make_pair(decode(param.substr(0, eq)),
+                                               eq == std::string::npos ? std::string() : decode(param.substr(eq + 1))));
+      }
+      if(amp == std::string::npos)
+      {
+        break;
+      }
+      begin = amp + 1;
+    }
+  }
+  while(pos < end)
+  {
+    std::size_t next = buffer.find("\r\n", pos + 2);
+    std::string header = buffer.substr(pos + 2, next - pos - 2);
+    std::size_t colon = header.find(':');
+    if(colon != std::string::npos)
+    {
+      std::string name = header.substr(0, colon);
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      std::size_t begin = header.find_first_not_of(" \t", colon + 1);
+      request.headers[name] = (begin == std::string::npos ? std::string() : header.substr(begin));
+    }
+    pos = next;
+  }
+  std::size_t length = std::strtoul(request.getHeader("content-length").c_str(), nullptr, 10);
+  buffer.erase(0, end + 4);
+  while(buffer.size() < length)
+  {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if(n <= 0)
+    {
+      return false;
+    }
+    buffer.append(chunk, chunk + n);
+  }
+  request.body = buffer.substr(0, length);
+  buffer.erase(0, length);
+  return true;
+}
+
+inline bool MockHttpServer::sendAll(int fd, const std::string & data)
+{
+  std::size_t sent = 0;
+  while(sent < data.size())
+  {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if(n <= 0)
+    {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+inline std::string MockHttpServer::decode(const std::string & str)
+{
+  std::string ret;
+  for(std::size_t i = 0; i < str.size(); i++)
+  {
+    if(str[i] == '%' && i + 2 < str.size())
+    {
+      ret.push_back(static_cast<char>(std::strtol(str.substr(i + 1, 2).c_str(), nullptr, 16)));
+      i += 2;
+    }
+    else if(str[i] == '+')
+    {
+      ret.push_back(' ');
+    }
+    else
+    {
+      ret.push_back(str[i]);
+    }
+  }
+  return ret;
+}
+
+inline const char * MockHttpServer::reason(int status)
+{
+  switch(status)
+  {
+  case 200: return "OK";
+  case 201: return "Created";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  default: return "Unknown";
+  }
+}
@@ -17,10 +17,22 @@ limitations under the License.
 */
 #include <catch2/catch.hpp>
 #include <surfsara/handle_util.h>
+#include <surfsara/handle_client.h>
 #include <surfsara/irods_handle_client.h>
+#include <surfsara/write_behind_handle_client.h>
+#include <surfsara/routing_handle_client.h>
+#include <surfsara/lookup_planner.h>
+#include <surfsara/reverse_lookup_client.h>
 #include <surfsara/json_format.h>
 #include <surfsara/json_parser.h>
 #include <surfsara/ast.h>
+#include "mock_http_server.h"
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unistd.h>
 
 using Node = surfsara::ast::Node;
 using Array = surfsara::ast::Array;
@@ -42,6 +54,8 @@ struct HandleClientMock : public I_HandleClient
 {
   std::function<Result(const std::string & prefix, const surfsara::ast::Node & node)> mockCreate;
   std::function<Result(const std::string & handle)> mockGet;
+  std::function<Result(const std::string & handle, const std::vector<int> & indices)> mockGetIndices;
+  std::function<Result(const std::string & handle, const std::vector<std::string> & types)> mockGetTypes;
   std::function<Result(const std::string & handle, const surfsara::ast::Node & node)> mockUpdate;
   std::function<Result(const std::string & handle, const std::vector<int> & indices)> mockRemoveIndices;
   std::function<Result(const std::string & handle)> mockRemove;
@@ -57,6 +71,16 @@ struct HandleClientMock : public I_HandleClient
     return mockGet(handle);
   }
 
+  virtual Result get(const std::string & handle, const std::vector<int> & indices) override
+  {
+    return mockGetIndices(handle, indices);
+  }
+
+  virtual Result get(const std::string & handle, const std::vector<std::string> & types) override
+  {
+    return mockGetTypes(handle, types);
+  }
+
   virtual Result update(const std::string & handle, const surfsara::ast::Node & node) override
   {
     return mockUpdate(handle, node);
@@ -76,13 +100,55 @@ struct HandleClientMock : public I_HandleClient
 struct ReverseLookupClientMock : public I_ReverseLookupClient
 {
   std::function<std::vector<std::string>(const std::vector<std::pair<std::string, std::string>>&)> mockLookup;
+  std::function<std::vector<std::pair<std::string, surfsara::ast::Node>>(const std::vector<std::pair<std::string, std::string>>&)> mockLookupRecords;
 
   virtual std::vector<std::string> lookup(const std::vector<std::pair<std::string, std::string>> & query)
   {
     return mockLookup(query);
   }
+
+  virtual bool lookupRecords(const std::vector<std::pair<std::string, std::string>> & query,
+                             std::vector<std::pair<std::string, surfsara::ast::Node>> & records) override
+  {
+    if(mockLookupRecords)
+    {
+      records = mockLookupRecords(query);
+      return true;
+    }
+    return false;
+  }
+
+  virtual bool lookupRecordsEach(const std::vector<std::pair<std::string, std::string>> & query,
+                                 std::function<bool(const std::string & handle,
+                                                    const surfsara::ast::Node & values)> func) override
+  {
+    if(mockLookupRecords)
+    {
+      for(auto & record : mockLookupRecords(query))
+      {
+        if(!func(record.first, record.second))
+        {
+          break;
+        }
+      }
+      return true;
+    }
+    return false;
+  }
 };
 
+// record with an IRODS/URL entry, as returned by the handle server
+static Result urlRecord(const std::string & handle, const std::string & url)
+{
+  Result res;
+  res.success = true;
+  res.handle = handle;
+  res.data = surfsara::ast::parseJson(std::string("{\"values\":["
+                                                  "{\"index\":1,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"") +
+                                      url + "\"}}]}");
+  return res;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // helper functions
@@ -208,6 +274,25 @@ TEST_CASE("deep update", "[Handle]")
 // IRodsHandleClient
 //
 ////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("diff records", "[Handle]")
+{
+  Node before = surfsara::ast::parseJson("{\"values\":["
+                                         "{\"index\":1,\"type\":\"A\",\"data\":{\"format\":\"string\",\"value\":\"a\"}},"
+                                         "{\"index\":2,\"type\":\"B\",\"data\":{\"format\":\"string\",\"value\":\"b\"}},"
+                                         "{\"index\":3,\"type\":\"C\",\"data\":{\"format\":\"string\",\"value\":\"c\"}}]}");
+  Node after = surfsara::ast::parseJson("{\"values\":["
+                                        "{\"index\":1,\"type\":\"A\",\"data\":{\"format\":\"string\",\"value\":\"a\"}},"
+                                        "{\"index\":3,\"type\":\"C\",\"data\":{\"format\":\"string\",\"value\":\"changed\"}},"
+                                        "{\"index\":4,\"type\":\"D\",\"data\":{\"format\":\"string\",\"value\":\"d\"}}]}");
+  auto diff = diffRecords(snapshotRecord(before), after);
+  REQUIRE(diff.hasUpdate());
+  REQUIRE(getIndices(diff.update) == std::vector<int>({3, 4}));
+  REQUIRE(diff.removed == std::vector<int>{2});
+  auto same = diffRecords(snapshotRecord(before), before);
+  REQUIRE_FALSE(same.hasUpdate());
+  REQUIRE(same.removed.empty());
+}
+
 TEST_CASE("create irods handle", "[IRodsHandleClient]" )
 {
 
@@ -427,12 +512,11 @@ TEST_CASE("update irods handle with webdav", "[IRodsHandleClient]" )
       updated = true;
       REQUIRE(handle == "prefix-uuid");
       Array arr = node.as<Object>()["values"].as<Array>();
-      REQUIRE(arr.size() == 5);
-      REQUIRE(surfsara::ast::formatJson(arr[0])=="{\"index\":1,\"type\":\"IRODS/SERVER\",\"data\":{\"format\":\"string\",\"value\":\"myserver\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[1])=="{\"index\":2,\"type\":\"IRODS/SERVER_PORT\",\"data\":{\"format\":\"string\",\"value\":\"1247\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[2])=="{\"index\":3,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[3])=="{\"index\":4,\"type\":\"URL\",\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver:80/new/path/to/object.txt\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[4])=="{\"index\":5,\"type\":\"IRODS/WEBDAV_URL\",\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver:80/new/path/to/object.txt\"}}");
+      // unchanged entries 1 and 2 are not sent
+      REQUIRE(arr.size() == 3);
+      REQUIRE(surfsara::ast::formatJson(arr[0])=="{\"index\":3,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
+      REQUIRE(surfsara::ast::formatJson(arr[1])=="{\"index\":4,\"type\":\"URL\",\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver:80/new/path/to/object.txt\"}}");
+      REQUIRE(surfsara::ast::formatJson(arr[2])=="{\"index\":5,\"type\":\"IRODS/WEBDAV_URL\",\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver:80/new/path/to/object.txt\"}}");
       Result res;
       return res;
     };
@@ -490,12 +574,11 @@ TEST_CASE("update irods handle with webdav removal", "[IRodsHandleClient]" )
       updated = true;
       REQUIRE(handle == "prefix-uuid");
       Array arr = node.as<Object>()["values"].as<Array>();
-      REQUIRE(arr.size() == 5);
-      REQUIRE(surfsara::ast::formatJson(arr[0])=="{\"index\":1,\"type\":\"IRODS/SERVER\",\"data\":{\"format\":\"string\",\"value\":\"myserver\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[1])=="{\"index\":2,\"type\":\"IRODS/SERVER_PORT\",\"data\":{\"format\":\"string\",\"value\":\"1247\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[2])=="{\"index\":3,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[3])=="{\"index\":4,\"type\":\"URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[4])=="{\"index\":6,\"type\":\"CUSTOM\",\"data\":{\"format\":\"string\",\"value\":\"value\"}}");
+      // unchanged entries 1 and 6 are not sent
+      REQUIRE(arr.size() == 3);
+      REQUIRE(surfsara::ast::formatJson(arr[0])=="{\"index\":2,\"type\":\"IRODS/SERVER_PORT\",\"data\":{\"format\":\"string\",\"value\":\"1247\"}}");
+      REQUIRE(surfsara::ast::formatJson(arr[1])=="{\"index\":3,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
+      REQUIRE(surfsara::ast::formatJson(arr[2])=="{\"index\":4,\"type\":\"URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247/new/path/to/object.txt\"}}");
       Result res;
       res.success = true;
       return res;
@@ -545,6 +628,535 @@ TEST_CASE("remove irods handle", "[IRodsHandleClient]" )
   REQUIRE(removed);
 }
 
+TEST_CASE("path cache saves reverse lookups", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"},
+                               {"IRODS_SERVER", "myserver"},
+                               {"IRODS_PORT", "1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}",
+                           std::make_shared<PathCache>(10));
+  std::size_t lookups = 0;
+  reverseLookup->mockLookup = [&lookups](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      if(query[0].second == "irods://myserver:1247/path/to/object.txt")
+      {
+        return std::vector<std::string>({"prefix/uuid"});
+      }
+      return std::vector<std::string>();
+    };
+  auto record = [](const std::string & handle)
+    {
+      return urlRecord(handle, std::string("irods://myserver:1247") +
+                       (handle == "prefix/uuid" ? "/path/to/object.txt" : "/path/to/new.txt"));
+    };
+  handleClient->mockGet = record;
+  handleClient->mockGetTypes = [&record](const std::string & handle, const std::vector<std::string> & types)
+    {
+      return record(handle);
+    };
+  handleClient->mockCreate = [](const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      Result res;
+      res.success = true;
+      res.handle = prefix + "/new";
+      return res;
+    };
+  handleClient->mockRemove = [](const std::string & handle)
+    {
+      Result res;
+      res.success = true;
+      return res;
+    };
+  REQUIRE(client.get("/path/to/object.txt").handle == "prefix/uuid");
+  REQUIRE(client.get("/path/to/object.txt").handle == "prefix/uuid");
+  REQUIRE(client.lookupOne("/path/to/object.txt") == "prefix/uuid");
+  REQUIRE(lookups == 1);
+
+  // populated on create
+  client.create("/path/to/new.txt", {});
+  REQUIRE(client.lookupOne("/path/to/new.txt") == "prefix/new");
+  REQUIRE(lookups == 1);
+
+  // evicted on remove
+  client.removeHandle("prefix/new");
+  REQUIRE_THROWS(client.lookupOne("/path/to/new.txt"));
+  REQUIRE(lookups == 2);
+  REQUIRE(client.getStatistics().reverseLookups == 2);
+  REQUIRE(client.getStatistics().pathCache.hits == 3);
+}
+
+TEST_CASE("remove checks the cached handle of a path", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}",
+                           std::make_shared<PathCache>(10));
+  // another process moves prefix/uuid away and creates prefix/other for the path
+  bool moved = false;
+  reverseLookup->mockLookup = [&moved](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return std::vector<std::string>({moved ? "prefix/other" : "prefix/uuid"});
+    };
+  handleClient->mockGetTypes = [&moved](const std::string & handle, const std::vector<std::string> & types)
+    {
+      return urlRecord(handle, (moved && handle == "prefix/uuid") ?
+                       "irods://myserver:1247/path/to/moved.txt" : "irods://myserver:1247/path/to/object.txt");
+    };
+  std::string removed;
+  handleClient->mockRemove = [&removed](const std::string & handle)
+    {
+      removed = handle;
+      Result res;
+      res.success = true;
+      return res;
+    };
+  REQUIRE(client.lookupOne("/path/to/object.txt") == "prefix/uuid");
+  moved = true;
+  REQUIRE(client.remove("/path/to/object.txt").success);
+  REQUIRE(removed == "prefix/other");
+}
+
+TEST_CASE("negative cache saves lookups of paths without handle", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"},
+                               {"IRODS_SERVER", "myserver"},
+                               {"IRODS_PORT", "1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}",
+                           nullptr,
+                           std::make_shared<NegativeCache>(10));
+  std::size_t lookups = 0;
+  bool created = false;
+  reverseLookup->mockLookup = [&lookups, &created](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      if(created)
+      {
+        return std::vector<std::string>({"prefix/new"});
+      }
+      return std::vector<std::string>();
+    };
+  handleClient->mockCreate = [&created](const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      created = true;
+      Result res;
+      res.success = true;
+      res.handle = prefix + "/new";
+      return res;
+    };
+  REQUIRE(client.lookup("/path/to/new.txt").empty());
+  REQUIRE(client.lookup("/path/to/new.txt").empty());
+  REQUIRE_THROWS(client.lookupOne("/path/to/new.txt"));
+  REQUIRE(lookups == 1);
+  REQUIRE(client.getStatistics().negativeCache.hits == 2);
+
+  // invalidated on create
+  client.create("/path/to/new.txt", {});
+  REQUIRE(client.lookupOne("/path/to/new.txt") == "prefix/new");
+  REQUIRE(lookups == 2);
+  REQUIRE(client.getStatistics().negativeCache.hitRate() == 0.5);
+}
+
+TEST_CASE("bloom filter skips lookup before create of new paths", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  auto filter = std::make_shared<surfsara::util::BloomFilter>(100);
+  filter->add("irods://myserver:1247/path/to/existing.txt");
+  filter->setComplete();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"},
+                               {"IRODS_SERVER", "myserver"},
+                               {"IRODS_PORT", "1247"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}",
+                           nullptr,
+                           nullptr,
+                           filter);
+  std::size_t lookups = 0;
+  reverseLookup->mockLookup = [&lookups](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      return std::vector<std::string>({"prefix/existing"});
+    };
+  handleClient->mockCreate = [](const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      Result res;
+      res.success = true;
+      res.handle = prefix + "/new";
+      return res;
+    };
+  client.create("/path/to/new.txt", {});
+  REQUIRE(lookups == 0);
+  REQUIRE(client.getStatistics().bloomFilterSkips == 1);
+  REQUIRE(filter->mayContain("irods://myserver:1247/path/to/new.txt"));
+
+  // positive answers are checked with the lookup service
+  REQUIRE_THROWS(client.create("/path/to/new.txt", {}));
+  REQUIRE_THROWS(client.create("/path/to/existing.txt", {}));
+  REQUIRE(lookups == 2);
+}
+
+TEST_CASE("path index resolves paths of other processes", "[IRodsHandleClient]" )
+{
+  char name[] = "/tmp/test_path_index_XXXXXX";
+  int fd = mkstemp(name);
+  REQUIRE(fd >= 0);
+  close(fd);
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  auto makeClient = [&]() {
+    return std::make_shared<IRodsHandleClient>(handleClient,
+                                               "prefix",
+                                               reverseLookup,
+                                               std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                                                   {"IRODS_URL_PREFIX", "irods://myserver:1247"},
+                                                   {"IRODS_SERVER", "myserver"},
+                                                   {"IRODS_PORT", "1247"}}),
+                                               false,
+                                               "IRODS/URL",
+                                               "{IRODS_URL_PREFIX}{OBJECT}",
+                                               nullptr,
+                                               nullptr,
+                                               nullptr,
+                                               std::make_shared<surfsara::util::PathIndex>(name, 64));
+  };
+  // IRODS/URL of the handles on the server
+  std::map<std::string, std::string> urls;
+  std::size_t lookups = 0;
+  reverseLookup->mockLookup = [&lookups, &urls](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      std::vector<std::string> ret;
+      for(auto & p : urls)
+      {
+        if(p.second == query[0].second)
+        {
+          ret.push_back(p.first);
+        }
+      }
+      return ret;
+    };
+  handleClient->mockGetTypes = [&urls](const std::string & handle, const std::vector<std::string> & types)
+    {
+      return urlRecord(handle, urls[handle]);
+    };
+  handleClient->mockCreate = [&urls](const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      Result res;
+      res.success = true;
+      res.handle = prefix + "/new";
+      urls[res.handle] = extractValueByType(node, "IRODS/URL");
+      return res;
+    };
+  handleClient->mockRemove = [&urls](const std::string & handle)
+    {
+      Result res;
+      res.success = (urls.erase(handle) == 1);
+      return res;
+    };
+  makeClient()->create("/path/to/new.txt", {});
+
+  auto client = makeClient();
+  REQUIRE(client->lookupOne("/path/to/new.txt") == "prefix/new");
+  REQUIRE(lookups == 0);
+  REQUIRE(client->getStatistics().pathIndexHits == 1);
+
+  client->removeHandle("prefix/new");
+  REQUIRE_THROWS(makeClient()->lookupOne("/path/to/new.txt"));
+  REQUIRE(lookups == 1);
+
+  // moved by a process without the index, the stale entry is evicted
+  makeClient()->create("/path/to/new.txt", {});
+  urls["prefix/new"] = "irods://myserver:1247/path/to/moved.txt";
+  urls["prefix/other"] = "irods://myserver:1247/path/to/new.txt";
+  client = makeClient();
+  REQUIRE(client->lookupOne("/path/to/new.txt") == "prefix/other");
+  REQUIRE(lookups == 2);
+  REQUIRE(makeClient()->lookupOne("/path/to/new.txt") == "prefix/other");
+  REQUIRE(lookups == 2);
+  std::remove(name);
+}
+
+TEST_CASE("lookup many paths", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}",
+                           std::make_shared<PathCache>(10));
+  std::size_t lookups = 0;
+  reverseLookup->mockLookup = [&lookups](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      REQUIRE(query.size() == 1);
+      REQUIRE(query[0].first == "IRODS/URL");
+      if(query[0].second == "irods://myserver:1247/a")
+      {
+        return std::vector<std::string>({"prefix/a"});
+      }
+      else if(query[0].second == "irods://myserver:1247/b")
+      {
+        return std::vector<std::string>({"prefix/b1", "prefix/b2"});
+      }
+      return std::vector<std::string>();
+    };
+  auto res = client.lookupMany({"/a", "/b", "/c", "/a"});
+  REQUIRE(res.size() == 4);
+  REQUIRE(res[0] == std::vector<std::string>({"prefix/a"}));
+  REQUIRE(res[1] == std::vector<std::string>({"prefix/b1", "prefix/b2"}));
+  REQUIRE(res[2].empty());
+  REQUIRE(res[3] == std::vector<std::string>({"prefix/a"}));
+  // duplicates are sent once
+  REQUIRE(lookups == 3);
+  REQUIRE(client.lookupOne("/a") == "prefix/a");
+  REQUIRE(lookups == 3);
+}
+
+TEST_CASE("create many irods handles", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}");
+  std::atomic<std::size_t> lookups(0);
+  reverseLookup->mockLookup = [&lookups](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      lookups++;
+      if(query[0].second == "irods://myserver:1247/exists")
+      {
+        return std::vector<std::string>({"prefix/exists"});
+      }
+      return std::vector<std::string>();
+    };
+  std::mutex mutex;
+  std::set<std::string> created;
+  handleClient->mockCreate = [&mutex, &created](const std::string & prefix, const surfsara::ast::Node & node)
+    {
+      // called concurrently, checked after createMany
+      auto url = prefix + " " + surfsara::handle::extractValueByType(node, "IRODS/URL");
+      Result res;
+      res.success = (url != "irods://myserver:1247/fails");
+      res.handle = "prefix/" + url.substr(url.rfind('/') + 1);
+      std::lock_guard<std::mutex> lock(mutex);
+      created.insert(url);
+      return res;
+    };
+  auto res = client.createMany({"/a", "/exists", "/b", "/a", "/fails"},
+                               {{"KEY", "value"}},
+                               3);
+  REQUIRE(res.size() == 5);
+  REQUIRE(res[0].path == "/a");
+  REQUIRE(res[0].error.empty());
+  REQUIRE(res[0].result.success);
+  REQUIRE(res[0].result.handle == "prefix/a");
+  REQUIRE(res[1].error == "Object with IRODS/URL=irods://myserver:1247/exists already exists.");
+  REQUIRE(res[2].result.handle == "prefix/b");
+  REQUIRE_FALSE(res[3].error.empty());
+  REQUIRE(res[4].error.empty());
+  REQUIRE_FALSE(res[4].result.success);
+  REQUIRE(lookups == 4);
+  REQUIRE(created == std::set<std::string>({"prefix irods://myserver:1247/a",
+                                            "prefix irods://myserver:1247/b",
+                                            "prefix irods://myserver:1247/fails"}));
+}
+
+TEST_CASE("move irods collection", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}");
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      REQUIRE(query == std::vector<std::pair<std::string, std::string>>({{"IRODS/URL", "irods://myserver:1247/old/*"}}));
+      return std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3"});
+    };
+  // called concurrently, checked after moveCollection
+  handleClient->mockGet = [](const std::string & handle)
+    {
+      std::string path(handle == "prefix/1" ? "/old/a.txt" :
+                       (handle == "prefix/2" ? "/old/sub/b.txt" : "/other/c.txt"));
+      Result res;
+      res.success = true;
+      res.data = surfsara::ast::parseJson(std::string("{\"values\":["
+                                                      "{\"index\":1,\"type\":\"IRODS/URL\",\"data\":{\"format\":\"string\",\"value\":\"irods://myserver:1247") +
+                                          path + "\"}}]}");
+      return res;
+    };
+  std::mutex mutex;
+  std::map<std::string, std::string> updated;
+  handleClient->mockUpdate = [&mutex, &updated](const std::string & handle, const surfsara::ast::Node & node)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      updated[handle] = surfsara::handle::extractValueByType(node, "IRODS/URL");
+      Result res;
+      res.success = true;
+      return res;
+    };
+  handleClient->mockRemoveIndices = [](const std::string & handle, const std::vector<int> & indices)
+    {
+      Result res;
+      res.success = true;
+      return res;
+    };
+  std::size_t calls = 0;
+  auto res = client.moveCollection("/old/", "/new", 2,
+                                   [&calls](const IRodsHandleClient::MoveResult & r, std::size_t done, std::size_t total) {
+                                     calls++;
+                                   });
+  REQUIRE(calls == 3);
+  REQUIRE(res.size() == 3);
+  REQUIRE(res[0].oldPath == "/old/a.txt");
+  REQUIRE(res[0].newPath == "/new/a.txt");
+  REQUIRE(res[0].error.empty());
+  REQUIRE(res[1].newPath == "/new/sub/b.txt");
+  REQUIRE(res[1].result.success);
+  REQUIRE_FALSE(res[2].error.empty());
+  REQUIRE(updated == std::map<std::string, std::string>({{"prefix/1", "irods://myserver:1247/new/a.txt"},
+                                                         {"prefix/2", "irods://myserver:1247/new/sub/b.txt"}}));
+
+  // wildcards of the collection name are escaped
+  std::string pattern;
+  reverseLookup->mockLookup = [&pattern](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      pattern = query[0].second;
+      return std::vector<std::string>();
+    };
+  REQUIRE(client.moveCollection("/old*[1]", "/new").empty());
+  REQUIRE(pattern == "irods://myserver:1247/old\\*\\[1]/*");
+}
+
+TEST_CASE("remove irods collection", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"}}),
+                           false,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}");
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      REQUIRE(query == std::vector<std::pair<std::string, std::string>>({{"IRODS/URL", "irods://myserver:1247/coll/*"}}));
+      return std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3", "prefix/4"});
+    };
+  // called concurrently
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      // prefix/4 has been moved since the lookup
+      return urlRecord(handle, std::string("irods://myserver:1247") + (handle == "prefix/4" ? "/other/d.txt" : "/coll/a.txt"));
+    };
+  std::mutex mutex;
+  std::set<std::string> removed;
+  handleClient->mockRemove = [&mutex, &removed](const std::string & handle)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      removed.insert(handle);
+      Result res;
+      res.success = (handle == "prefix/1");
+      res.curlResult.httpCode = (handle == "prefix/2" ? 404 : (handle == "prefix/1" ? 200 : 500));
+      return res;
+    };
+  std::size_t calls = 0;
+  auto summary = client.removeCollection("/coll", 2, 1000,
+                                         [&calls](const IRodsHandleClient::RemoveResult & r, std::size_t done, std::size_t total) {
+                                           calls++;
+                                         });
+  REQUIRE(calls == 4);
+  REQUIRE(summary.deleted == 1);
+  REQUIRE(summary.missing == 1);
+  REQUIRE(summary.skipped == 1);
+  REQUIRE(summary.failed == 1);
+  REQUIRE(removed == std::set<std::string>({"prefix/1", "prefix/2", "prefix/3"}));
+
+  // values of the records, no GET
+  handleClient->mockGetTypes = nullptr;
+  removed.clear();
+  reverseLookup->mockLookupRecords = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      std::vector<std::pair<std::string, surfsara::ast::Node>> ret;
+      ret.push_back(std::make_pair("prefix/1", urlRecord("prefix/1", "irods://myserver:1247/coll/a.txt").data.get().find("values")));
+      ret.push_back(std::make_pair("prefix/5", urlRecord("prefix/5", "irods://myserver:1247/collection/e.txt").data.get().find("values")));
+      return ret;
+    };
+  summary = client.removeCollection("/coll", 2);
+  REQUIRE(summary.deleted == 1);
+  REQUIRE(summary.skipped == 1);
+  REQUIRE(removed == std::set<std::string>({"prefix/1"}));
+
+  // failed GET of the value
+  reverseLookup->mockLookupRecords = nullptr;
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return std::vector<std::string>({"prefix/6"});
+    };
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      Result res;
+      res.curlResult.httpCode = 500;
+      return res;
+    };
+  removed.clear();
+  std::string error;
+  summary = client.removeCollection("/coll", 1, 0,
+                                    [&mutex, &error](const IRodsHandleClient::RemoveResult & r, std::size_t done, std::size_t total) {
+                                      std::lock_guard<std::mutex> lock(mutex);
+                                      error = r.error;
+                                    });
+  REQUIRE(summary.failed == 1);
+  REQUIRE(removed.empty());
+  REQUIRE(error.find("http code 500") != std::string::npos);
+}
+
 TEST_CASE("update irods handle metadata", "[IRodsHandleClient]" )
 {
   auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
@@ -592,14 +1204,14 @@ TEST_CASE("update irods handle metadata", "[IRodsHandleClient]" )
       updated = true;
       REQUIRE(handle == "prefix-uuid");
       Array arr = node.as<Object>()["values"].as<Array>();
-      REQUIRE(arr.size() == 8);
-      REQUIRE(surfsara::ast::formatJson(arr[5])==
+      REQUIRE(arr.size() == 3);
+      REQUIRE(surfsara::ast::formatJson(arr[0])==
               "{\"index\":6,\"type\":\"OLD_VALUE\","
               "\"data\":{\"format\":\"string\",\"value\":\"new\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[6])==
+      REQUIRE(surfsara::ast::formatJson(arr[1])==
               "{\"index\":7,\"type\":\"ADDED_VALUE\","
               "\"data\":{\"format\":\"string\",\"value\":\"add1\"}}");
-      REQUIRE(surfsara::ast::formatJson(arr[7])==
+      REQUIRE(surfsara::ast::formatJson(arr[2])==
               "{\"index\":8,\"type\":\"ADDED_VALUE2\","
               "\"data\":{\"format\":\"string\",\"value\":\"add2\"}}");
       Result res;
@@ -622,4 +1234,576 @@ TEST_CASE("update irods handle metadata", "[IRodsHandleClient]" )
   REQUIRE_FALSE(removed);
 }
 
+TEST_CASE("records of the reverse lookup save the get", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver/"},
+                               {"IRODS_WEBDAV_PREFIX", "webdav://myserver"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_WEBDAV_PREFIX}{OBJECT}");
+  reverseLookup->mockLookupRecords = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      REQUIRE(query.size() == 1);
+      REQUIRE(query[0].second == "webdav://myserver/path/to/object.txt");
+      std::vector<std::pair<std::string, surfsara::ast::Node>> ret;
+      ret.push_back(std::make_pair(std::string("prefix-uuid"),
+                                   surfsara::ast::parseJson("["
+                                                            "{\"index\":1,\"type\":\"URL\","
+                                                            "\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver/path/to/object.txt\"}},"
+                                                            "{\"index\":6,\"type\":\"OLD_VALUE\","
+                                                            "\"data\":{\"format\":\"string\",\"value\":\"old\"}}]")));
+      return ret;
+    };
+  handleClient->mockGet = [](const std::string & handle)
+    {
+      FAIL("record has been retrieved with the lookup");
+      return Result();
+    };
+  bool updated = false;
+  handleClient->mockUpdate = [&updated](const std::string & handle,
+                                        const surfsara::ast::Node & node)
+    {
+      updated = true;
+      REQUIRE(handle == "prefix-uuid");
+      Array arr = node.as<Object>()["values"].as<Array>();
+      REQUIRE(arr.size() == 1);
+      REQUIRE(surfsara::ast::formatJson(arr[0])==
+              "{\"index\":6,\"type\":\"OLD_VALUE\","
+              "\"data\":{\"format\":\"string\",\"value\":\"new\"}}");
+      Result res;
+      res.success = true;
+      return res;
+    };
+
+  auto res = client.get("/path/to/object.txt");
+  REQUIRE(res.success);
+  REQUIRE(res.handle == "prefix-uuid");
+  REQUIRE(surfsara::handle::extractValueByType(res.data, "OLD_VALUE") == "old");
+
+  client.set("/path/to/object.txt",
+             std::vector<std::pair<std::string, std::string>>{{"OLD_VALUE", "new"}});
+  REQUIRE(updated);
+}
+
+TEST_CASE("records of the reverse lookup see deferred writes", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  auto writeBehind = std::make_shared<WriteBehindHandleClient>(handleClient, std::chrono::hours(1));
+  IRodsHandleClient client(writeBehind,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver/"},
+                               {"IRODS_WEBDAV_PREFIX", "webdav://myserver"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_WEBDAV_PREFIX}{OBJECT}");
+  reverseLookup->mockLookupRecords = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      std::vector<std::pair<std::string, surfsara::ast::Node>> ret;
+      ret.push_back(std::make_pair(std::string("prefix-uuid"),
+                                   surfsara::ast::parseJson("["
+                                                            "{\"index\":1,\"type\":\"URL\","
+                                                            "\"data\":{\"format\":\"string\",\"value\":\"webdav://myserver/path/to/object.txt\"}}]")));
+      return ret;
+    };
+  handleClient->mockGet = [](const std::string & handle)
+    {
+      FAIL("record has been retrieved with the lookup");
+      return Result();
+    };
+  handleClient->mockUpdate = [](const std::string & handle, const surfsara::ast::Node & node)
+    {
+      Result res;
+      res.success = true;
+      return res;
+    };
+  client.set("/path/to/object.txt",
+             std::vector<std::pair<std::string, std::string>>{{"KEY", "queued"}});
+  REQUIRE(writeBehind->pendingSize() == 1);
+
+  auto res = client.get("/path/to/object.txt");
+  REQUIRE(res.success);
+  REQUIRE(surfsara::handle::extractValueByType(res.data, "KEY") == "queued");
+}
+
+TEST_CASE("get irods handle by type", "[IRodsHandleClient]" )
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  IRodsHandleClient client(handleClient,
+                           "prefix",
+                           reverseLookup,
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver/"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}");
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return std::vector<std::string>({"prefix-uuid"});
+    };
+  bool fullRecord = false;
+  handleClient->mockGet = [&fullRecord](const std::string & handle)
+    {
+      fullRecord = true;
+      Result res;
+      return res;
+    };
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      REQUIRE(handle == "prefix-uuid");
+      REQUIRE(types == std::vector<std::string>{"KEY"});
+      Result res;
+      res.success = true;
+      res.data = surfsara::ast::parseJson("{\"values\":["
+                                          "{\"index\":6,\"type\":\"KEY\","
+                                          "\"data\":{\"format\":\"string\",\"value\":\"value\"}}]}");
+      return res;
+    };
+  auto res = client.get("/path/to/object.txt", std::vector<std::string>{"KEY"});
+  REQUIRE(res.success);
+  REQUIRE(extractValueByType(res.data, "KEY") == "value");
+  REQUIRE_FALSE(fullRecord);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Result
+//
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("result data is decoded on first access", "[Result]")
+{
+  Result res;
+  res.curlResult.body = "{\"responseCode\":1,\"handle\":\"prefix/suffix\"}";
+  res.setLazyData();
+  REQUIRE_FALSE(res.data.isDecoded());
+  Result copy(res);
+  REQUIRE_FALSE(copy.data.isDecoded());
+  REQUIRE(res.data.get().find("handle") == String("prefix/suffix"));
+  REQUIRE(res.data.isDecoded());
+  REQUIRE_FALSE(copy.data.isDecoded());
+  copy.curlResult.body = "{\"handle\":\"other\"}";
+  REQUIRE(copy.data.get().find("handle") == String("other"));
+  res.data = Object{{"handle", String("assigned")}};
+  REQUIRE(res.data.get().find("handle") == String("assigned"));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// HandleClient
+//
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("expired records are revalidated with a conditional get", "[HandleClient]")
+{
+  std::string value("v1");
+  std::vector<std::string> conditions;
+  std::size_t notModified = 0;
+  MockHttpServer server([&](const HttpRequest & request) {
+      std::string etag = "\"" + value + "\"";
+      if(request.method == "PUT")
+      {
+        value = extractValueByType(surfsara::ast::parseJson(request.body), "KEY");
+        return HttpResponse(200, "{\"responseCode\":1,\"handle\":\"prefix/h\"}");
+      }
+      conditions.push_back(request.getHeader("if-none-match"));
+      if(request.getHeader("if-none-match") == etag)
+      {
+        notModified++;
+        return HttpResponse(304);
+      }
+      HttpResponse res(200, std::string("{\"responseCode\":1,\"handle\":\"prefix/h\",\"values\":["
+                                        "{\"index\":1,\"type\":\"KEY\",\"data\":{\"format\":\"string\",\"value\":\"") +
+                       value + "\"}}]}");
+      res.headers["ETag"] = etag;
+      return res;
+    });
+  auto cache = std::make_shared<RecordCache>(10, 0, std::chrono::milliseconds(100));
+  HandleClient client(server.getUrl() + "/api/handles", {}, false, cache);
+  auto expire = []() { std::this_thread::sleep_for(std::chrono::milliseconds(150)); };
+
+  REQUIRE(extractValueByType(client.get("prefix/h").data, "KEY") == "v1");
+  expire();
+  // 304: served from the cache
+  auto res = client.get("prefix/h");
+  REQUIRE(res.success);
+  REQUIRE(extractValueByType(res.data, "KEY") == "v1");
+  REQUIRE(notModified == 1);
+  REQUIRE(cache->getStatistics().revalidations == 1);
+  REQUIRE(conditions == std::vector<std::string>({"", "\"v1\""}));
+
+  // the record modified by write-through is not revalidated with the old ETag
+  REQUIRE(client.update("prefix/h", surfsara::ast::parseJson("{\"values\":[{\"index\":1,\"type\":\"KEY\","
+                                                             "\"data\":{\"format\":\"string\",\"value\":\"v2\"}}]}")).success);
+  REQUIRE(extractValueByType(client.get("prefix/h").data, "KEY") == "v2");
+  REQUIRE(conditions.size() == 2);
+  expire();
+  REQUIRE(extractValueByType(client.get("prefix/h").data, "KEY") == "v2");
+  REQUIRE(conditions == std::vector<std::string>({"", "\"v1\"", ""}));
+  expire();
+  REQUIRE(extractValueByType(client.get("prefix/h").data, "KEY") == "v2");
+  REQUIRE(notModified == 2);
+  REQUIRE(conditions == std::vector<std::string>({"", "\"v1\"", "", "\"v2\""}));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// WriteBehindHandleClient
+//
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("write behind coalesces updates of a handle", "[WriteBehindHandleClient]")
+{
+  auto handleClient = std::make_shared<HandleClientMock>();
+  std::size_t numUpdates = 0;
+  std::size_t numRemoves = 0;
+  Node updated;
+  std::vector<int> removed;
+  handleClient->mockGet = [](const std::string & handle)
+    {
+      Result res;
+      res.success = true;
+      res.data = surfsara::ast::parseJson("{\"values\":["
+                                          "{\"index\":1,\"type\":\"URL\",\"data\":{\"format\":\"string\",\"value\":\"url\"}},"
+                                          "{\"index\":2,\"type\":\"KEY1\",\"data\":{\"format\":\"string\",\"value\":\"a\"}}]}");
+      return res;
+    };
+  handleClient->mockUpdate = [&](const std::string & handle, const Node & node)
+    {
+      REQUIRE(handle == "prefix/h");
+      numUpdates++;
+      updated = node;
+      Result res;
+      res.success = true;
+      return res;
+    };
+  handleClient->mockRemoveIndices = [&](const std::string & handle, const std::vector<int> & indices)
+    {
+      REQUIRE(handle == "prefix/h");
+      numRemoves++;
+      removed = indices;
+      Result res;
+      res.success = true;
+      return res;
+    };
+  WriteBehindHandleClient client(handleClient, std::chrono::hours(1));
+  auto entry = [](int index, const std::string & type, const std::string & value)
+    {
+      return surfsara::ast::parseJson(std::string("{\"values\":[{\"index\":") + std::to_string(index) +
+                                      ",\"type\":\"" + type + "\",\"data\":{\"format\":\"string\",\"value\":\"" +
+                                      value + "\"}}]}");
+    };
+  REQUIRE(client.update("prefix/h", entry(2, "KEY1", "b")).success);
+  REQUIRE(client.update("prefix/h", entry(3, "KEY2", "x")).success);
+  REQUIRE(client.removeIndices("prefix/h", {3}).success);
+  REQUIRE(client.update("prefix/h", entry(2, "KEY1", "c")).success);
+  REQUIRE(client.removeIndices("prefix/h", {1}).success);
+  REQUIRE(numUpdates == 0);
+  REQUIRE(numRemoves == 0);
+  REQUIRE(client.pendingSize() == 1);
+
+  auto res = client.get("prefix/h");
+  REQUIRE(getIndices(res.data.get()) == std::vector<int>{2});
+  REQUIRE(extractValueByType(res.data.get(), "KEY1") == "c");
+
+  REQUIRE(client.flush() == 0);
+  REQUIRE(client.pendingSize() == 0);
+  REQUIRE(numUpdates == 1);
+  REQUIRE(numRemoves == 1);
+  REQUIRE(removed == std::vector<int>{1, 3});
+  REQUIRE(getIndices(updated) == std::vector<int>{2});
+  REQUIRE(extractValueByType(updated, "KEY1") == "c");
+}
+
+TEST_CASE("write behind sends only the writes of a filtered handle", "[WriteBehindHandleClient]")
+{
+  auto handleClient = std::make_shared<HandleClientMock>();
+  std::vector<std::string> updated;
+  handleClient->mockUpdate = [&updated](const std::string & handle, const Node & node)
+    {
+      updated.push_back(handle);
+      Result res;
+      res.success = true;
+      return res;
+    };
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      Result res;
+      res.success = true;
+      return res;
+    };
+  WriteBehindHandleClient client(handleClient, std::chrono::hours(1));
+  auto entry = surfsara::ast::parseJson("{\"values\":[{\"index\":2,\"type\":\"KEY1\","
+                                        "\"data\":{\"format\":\"string\",\"value\":\"b\"}}]}");
+  REQUIRE(client.update("prefix/a", entry).success);
+  REQUIRE(client.update("prefix/b", entry).success);
+  REQUIRE(client.get("prefix/a", std::vector<std::string>{"KEY1"}).success);
+  REQUIRE(updated == std::vector<std::string>{"prefix/a"});
+  REQUIRE(client.pendingSize() == 1);
+  REQUIRE(client.flush() == 0);
+  REQUIRE(updated == std::vector<std::string>({"prefix/a", "prefix/b"}));
+}
+
+TEST_CASE("write behind reports failed writes", "[WriteBehindHandleClient]")
+{
+  auto handleClient = std::make_shared<HandleClientMock>();
+  handleClient->mockUpdate = [](const std::string & handle, const Node & node)
+    {
+      Result res;
+      res.handleCode = 100;
+      return res;
+    };
+  WriteBehindHandleClient client(handleClient, std::chrono::milliseconds(1));
+  REQUIRE(client.update("prefix/h", surfsara::ast::parseJson("{\"values\":[{\"index\":2,\"type\":\"KEY\","
+                                                             "\"data\":{\"format\":\"string\",\"value\":\"v\"}}]}")).success);
+  client.flush();
+  auto errors = client.takeErrors();
+  REQUIRE(errors.size() == 1);
+  REQUIRE(errors[0].handle == "prefix/h");
+  REQUIRE(errors[0].operation == "update");
+  REQUIRE(errors[0].handleCode == 100);
+  REQUIRE(client.takeErrors().empty());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RoutingHandleClient
+//
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("route handles by prefix", "[RoutingHandleClient]")
+{
+  auto client1 = std::make_shared<HandleClientMock>();
+  auto client2 = std::make_shared<HandleClientMock>();
+  std::vector<std::string> calls;
+  client1->mockGet = [&calls](const std::string & handle)
+    {
+      calls.push_back("1:" + handle);
+      Result res;
+      return res;
+    };
+  client2->mockGet = [&calls](const std::string & handle)
+    {
+      calls.push_back("2:" + handle);
+      Result res;
+      return res;
+    };
+  client1->mockCreate = [&calls](const std::string & prefix, const Node & node)
+    {
+      calls.push_back("1:" + prefix);
+      Result res;
+      return res;
+    };
+  client2->mockCreate = [&calls](const std::string & prefix, const Node & node)
+    {
+      calls.push_back("2:" + prefix);
+      Result res;
+      return res;
+    };
+  RoutingHandleClient client({{"P1", client1}, {"P2", client2}});
+  client.get("P2/abc");
+  client.get("P1/def");
+  client.create("P2", Object());
+  REQUIRE_THROWS(client.get("P3/abc"));
+  REQUIRE(calls == std::vector<std::string>({"2:P2/abc", "1:P1/def", "2:P2"}));
+
+  calls.clear();
+  RoutingHandleClient roundRobin({{"P1", client1}, {"P2", client2}},
+                                 RoutingHandleClient::parsePolicy("round_robin"));
+  roundRobin.create("P1", Object());
+  roundRobin.create("P1", Object());
+  roundRobin.create("P1", Object());
+  REQUIRE(calls == std::vector<std::string>({"1:P1", "2:P2", "1:P1"}));
+  REQUIRE_THROWS(RoutingHandleClient::parsePolicy("random"));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ReverseLookupClient
+//
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("lookup each handle with early termination", "[ReverseLookupClient]")
+{
+  ReverseLookupClientMock reverseLookup;
+  reverseLookup.mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3"});
+    };
+  std::vector<std::string> handles;
+  REQUIRE(reverseLookup.lookupEach({{"URL", "*"}}, [&handles](const std::string & handle) {
+        handles.push_back(handle);
+        return true;
+      }) == 3);
+  REQUIRE(handles == std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3"}));
+  handles.clear();
+  REQUIRE(reverseLookup.lookupEach({{"URL", "*"}}, [&handles](const std::string & handle) {
+        handles.push_back(handle);
+        return handles.size() < 2;
+      }) == 2);
+  REQUIRE(handles == std::vector<std::string>({"prefix/1", "prefix/2"}));
+}
+
+TEST_CASE("planner sends the most selective filter first", "[PlannedReverseLookupClient]")
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  auto planner = std::make_shared<LookupPlanner>();
+  PlannedReverseLookupClient client(reverseLookup, planner, 100, handleClient, 2);
+  std::vector<std::vector<std::pair<std::string, std::string>>> sent;
+  reverseLookup->mockLookup = [&sent](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      sent.push_back(query);
+      if(query.size() == 1 && query[0].first == "CHECKSUM")
+      {
+        return std::vector<std::string>({"prefix/1", "prefix/2"});
+      }
+      else if(query.size() == 1)
+      {
+        return std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3"});
+      }
+      return std::vector<std::string>({"prefix/2"});
+    };
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      REQUIRE(types == std::vector<std::string>({"URL"}));
+      Result res;
+      res.success = true;
+      res.data = surfsara::ast::parseJson(std::string("{\"values\":["
+                                                      "{\"index\":1,\"type\":\"URL\","
+                                                      "\"data\":{\"format\":\"string\",\"value\":\"irods://server/") +
+                                          (handle == "prefix/1" ? "other" : "zone") + "/a.txt\"}}]}");
+      return res;
+    };
+
+  // the exact checksum is sent alone, the url pattern is checked on the records
+  auto handles = client.lookup({{"URL", "irods://*/zone/*"}, {"CHECKSUM", "abc"}});
+  REQUIRE(handles == std::vector<std::string>({"prefix/2"}));
+  REQUIRE(sent.size() == 1);
+  REQUIRE(sent[0] == std::vector<std::pair<std::string, std::string>>({{"CHECKSUM", "abc"}}));
+  REQUIRE(planner->estimate({"CHECKSUM", "xyz"}) == 2.0);
+
+  // too many candidates to fetch: follow-up request in planned order
+  for(int i = 0; i < 10; i++)
+  {
+    planner->observe({"CHECKSUM", "abc"}, 1000);
+  }
+  sent.clear();
+  handles = client.lookup({{"CHECKSUM", "abc"}, {"URL", "irods://server/zone/a.txt"}});
+  REQUIRE(handles == std::vector<std::string>({"prefix/2"}));
+  REQUIRE(sent.size() == 2);
+  REQUIRE(sent[0] == std::vector<std::pair<std::string, std::string>>({{"URL", "irods://server/zone/a.txt"}}));
+  REQUIRE(sent[1] == std::vector<std::pair<std::string, std::string>>({{"URL", "irods://server/zone/a.txt"},
+                                                                         {"CHECKSUM", "abc"}}));
+}
+
+TEST_CASE("planner observes only complete streams", "[PlannedReverseLookupClient]")
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto planner = std::make_shared<LookupPlanner>();
+  PlannedReverseLookupClient client(reverseLookup, planner, 100);
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      return std::vector<std::string>({"prefix/1", "prefix/2", "prefix/3"});
+    };
+  client.lookupEach({{"CHECKSUM", "abc"}}, [](const std::string & handle) {
+      return false;
+    });
+  REQUIRE(planner->estimate({"CHECKSUM", "abc"}) == 1.0);
+  client.lookupEach({{"CHECKSUM", "abc"}}, [](const std::string & handle) {
+      return true;
+    });
+  REQUIRE(planner->estimate({"CHECKSUM", "abc"}) == 3.0);
+}
+
+TEST_CASE("planner filters records of the reverse lookup", "[PlannedReverseLookupClient]")
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto planner = std::make_shared<LookupPlanner>();
+  PlannedReverseLookupClient client(reverseLookup, planner, 100);
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      FAIL("handles are taken from the records");
+      return std::vector<std::string>();
+    };
+  reverseLookup->mockLookupRecords = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      REQUIRE(query == std::vector<std::pair<std::string, std::string>>({{"CHECKSUM", "abc"}}));
+      std::vector<std::pair<std::string, surfsara::ast::Node>> ret;
+      ret.push_back(std::make_pair(std::string("prefix/1"),
+                                   surfsara::ast::parseJson("[{\"index\":1,\"type\":\"URL\","
+                                                            "\"data\":{\"format\":\"string\",\"value\":\"irods://a.txt\"}}]")));
+      ret.push_back(std::make_pair(std::string("prefix/2"),
+                                   surfsara::ast::parseJson("[{\"index\":1,\"type\":\"URL\","
+                                                            "\"data\":{\"format\":\"string\",\"value\":\"irods://b.csv\"}}]")));
+      return ret;
+    };
+  std::vector<std::string> handles;
+  client.lookupEach({{"URL", "*.csv"}, {"CHECKSUM", "abc"}}, [&handles](const std::string & handle) {
+      handles.push_back(handle);
+      return true;
+    });
+  REQUIRE(handles == std::vector<std::string>({"prefix/2"}));
+}
+
+TEST_CASE("planner verifies the handles of a lookup without records", "[PlannedReverseLookupClient]")
+{
+  auto reverseLookup = std::make_shared<ReverseLookupClientMock>();
+  auto handleClient = std::make_shared<HandleClientMock>();
+  auto planner = std::make_shared<LookupPlanner>();
+  PlannedReverseLookupClient client(reverseLookup, planner, 100, handleClient, 2);
+  reverseLookup->mockLookup = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      FAIL("the first filter has been sent with the records request");
+      return std::vector<std::string>();
+    };
+  reverseLookup->mockLookupRecords = [](const std::vector<std::pair<std::string, std::string>> & query)
+    {
+      // the service ignored retrieverecords
+      std::vector<std::pair<std::string, surfsara::ast::Node>> ret;
+      ret.push_back(std::make_pair(std::string("prefix/1"), surfsara::ast::Node()));
+      ret.push_back(std::make_pair(std::string("prefix/2"), surfsara::ast::Node()));
+      return ret;
+    };
+  handleClient->mockGetTypes = [](const std::string & handle, const std::vector<std::string> & types)
+    {
+      Result res;
+      res.success = true;
+      res.data = surfsara::ast::parseJson(std::string("{\"values\":["
+                                                      "{\"index\":1,\"type\":\"URL\","
+                                                      "\"data\":{\"format\":\"string\",\"value\":\"irods://") +
+                                          (handle == "prefix/1" ? "a.txt" : "b.csv") + "\"}}]}");
+      return res;
+    };
+  auto handles = client.lookup({{"URL", "*.csv"}, {"CHECKSUM", "abc"}});
+  REQUIRE(handles == std::vector<std::string>({"prefix/2"}));
+}
+
+TEST_CASE("adaptive page size follows the response time", "[ReverseLookupClient]")
+{
+  using ms = std::chrono::milliseconds;
+  AdaptivePaging paging(16, 256, ms(100));
+  REQUIRE(paging.clamp(100) == 64);
+  REQUIRE(paging.clamp(1) == 16);
+  REQUIRE(paging.clamp(1000) == 256);
+
+  // fast pages grow once the next page starts at a multiple of the new size
+  REQUIRE(paging.next(64, 64, ms(10), 64) == 64);
+  REQUIRE(paging.next(64, 64, ms(10), 128) == 128);
+  REQUIRE(paging.next(256, 256, ms(10), 512) == 256);
+
+  // slow pages shrink down to the lower bound
+  REQUIRE(paging.next(64, 64, ms(150), 64) == 32);
+  REQUIRE(paging.next(16, 16, ms(150), 16) == 16);
+
+  // last page and latency on target
+  REQUIRE(paging.next(64, 10, ms(10), 128) == 64);
+  REQUIRE(paging.next(64, 64, ms(70), 128) == 64);
+
+  REQUIRE_FALSE(AdaptivePaging().isEnabled());
+  REQUIRE(AdaptivePaging().next(100, 100, ms(1000), 100) == 100);
+}
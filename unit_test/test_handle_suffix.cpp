@@ -0,0 +1,101 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <catch2/catch.hpp>
+#include <surfsara/handle_suffix.h>
+#include <set>
+#include <thread>
+#include <mutex>
+
+using namespace surfsara::handle;
+
+TEST_CASE( "uuid v4 format", "[SuffixGenerator]" )
+{
+  UuidV4SuffixGenerator gen;
+  for(int i = 0; i < 100; i++)
+  {
+    std::string uuid = gen.generate();
+    REQUIRE(uuid.size() == 36);
+    REQUIRE(uuid[8] == '-');
+    REQUIRE(uuid[13] == '-');
+    REQUIRE(uuid[18] == '-');
+    REQUIRE(uuid[23] == '-');
+    REQUIRE(uuid[14] == '4');
+    REQUIRE(std::string("89ab").find(uuid[19]) != std::string::npos);
+    REQUIRE(uuid.find_first_not_of("0123456789abcdef-") == std::string::npos);
+  }
+}
+
+TEST_CASE( "uuid v4 is unique across threads", "[SuffixGenerator]" )
+{
+  UuidV4SuffixGenerator gen;
+  std::set<std::string> suffixes;
+  std::mutex mutex;
+  std::vector<std::thread> threads;
+  for(int t = 0; t < 4; t++)
+  {
+    threads.push_back(std::thread([&gen, &suffixes, &mutex]() {
+          for(int i = 0; i < 1000; i++)
+          {
+            std::string suffix = gen.generate();
+            std::lock_guard<std::mutex> lock(mutex);
+            suffixes.insert(suffix);
+          }
+        }));
+  }
+  for(auto & t : threads)
+  {
+    t.join();
+  }
+  REQUIRE(suffixes.size() == 4000);
+}
+
+TEST_CASE( "counter suffix", "[SuffixGenerator]" )
+{
+  CounterSuffixGenerator gen("node1");
+  std::string s1 = gen.generate();
+  std::string s2 = gen.generate();
+  REQUIRE(s1.size() == 5 + 1 + 8 + 1 + 16);
+  REQUIRE(s1.substr(0, 6) == "node1-");
+  REQUIRE(s1.substr(0, 15) == s2.substr(0, 15));
+  REQUIRE(s1.substr(15) == "0000000000000000");
+  REQUIRE(s2.substr(15) == "0000000000000001");
+}
+
+TEST_CASE( "uuid v7 is time ordered", "[SuffixGenerator]" )
+{
+  UuidV7SuffixGenerator gen;
+  std::string prev = gen.generate();
+  REQUIRE(prev.size() == 36);
+  REQUIRE(prev[14] == '7');
+  REQUIRE(std::string("89ab").find(prev[19]) != std::string::npos);
+  for(int i = 0; i < 10000; i++)
+  {
+    std::string next = gen.generate();
+    REQUIRE(prev < next);
+    prev = next;
+  }
+}
+
+TEST_CASE( "suffix generator by scheme", "[SuffixGenerator]" )
+{
+  REQUIRE(makeSuffixGenerator("")->generate()[14] == '4');
+  REQUIRE(makeSuffixGenerator("uuid4")->generate()[14] == '4');
+  REQUIRE(makeSuffixGenerator("uuid7")->generate()[14] == '7');
+  REQUIRE(makeSuffixGenerator("counter", "node")->generate().substr(0, 5) == "node-");
+  REQUIRE_THROWS(makeSuffixGenerator("uuid1"));
+}
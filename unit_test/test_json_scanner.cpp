@@ -0,0 +1,127 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <catch2/catch.hpp>
+#include <surfsara/json_scanner.h>
+#include <algorithm>
+#include <vector>
+
+using namespace surfsara::handle;
+
+TEST_CASE( "scan top level members", "[JsonScanner]" )
+{
+  std::map<std::string, std::string> raw;
+  std::string json("{ \"responseCode\" : 1,"
+                   "  \"nested\": {\"handle\": \"wrong\", \"list\": [1, \"]\", {}]},"
+                   "  \"handle\": \"prefix/suf\\\"fix\" }\n");
+  JsonScanner scanner(json);
+  REQUIRE(scanner.scanObject({"responseCode", "handle"}, raw));
+  REQUIRE(raw.size() == 2);
+  REQUIRE(raw["responseCode"] == "1");
+  REQUIRE(raw["handle"] == "\"prefix/suf\\\"fix\"");
+  long code = 0;
+  std::string handle;
+  REQUIRE(JsonScanner::decodeInteger(raw["responseCode"], code));
+  REQUIRE(code == 1);
+  REQUIRE(JsonScanner::decodeString(raw["handle"], handle));
+  REQUIRE(handle == "prefix/suf\"fix");
+}
+
+TEST_CASE( "scan empty object", "[JsonScanner]" )
+{
+  std::map<std::string, std::string> raw;
+  std::string json("{}");
+  JsonScanner scanner(json);
+  REQUIRE(scanner.scanObject({"handle"}, raw));
+  REQUIRE(raw.empty());
+}
+
+TEST_CASE( "scan rejects malformed documents", "[JsonScanner]" )
+{
+  std::map<std::string, std::string> raw;
+  std::vector<std::string> docs{"", "[]", "{", "{\"a\":}", "{\"a\" 1}",
+                                "{\"a\":1,}", "{\"a\":1} x", "{\"a\":\"x}", "{\"a\":[1,2}"};
+  for(auto & doc : docs)
+  {
+    JsonScanner scanner(doc);
+    REQUIRE_FALSE(scanner.scanObject({"a"}, raw));
+  }
+}
+
+TEST_CASE( "decode strings and integers", "[JsonScanner]" )
+{
+  std::string value;
+  long code;
+  REQUIRE(JsonScanner::decodeString("\"a\\u00e9\\ud83d\\ude00\\n\"", value));
+  REQUIRE(value == "a\xc3\xa9\xf0\x9f\x98\x80\n");
+  REQUIRE_FALSE(JsonScanner::decodeString("1", value));
+  REQUIRE_FALSE(JsonScanner::decodeString("\"abc", value));
+  REQUIRE(JsonScanner::decodeInteger("-100", code));
+  REQUIRE(code == -100);
+  REQUIRE_FALSE(JsonScanner::decodeInteger("1.5", code));
+  REQUIRE_FALSE(JsonScanner::decodeInteger("\"1\"", code));
+}
+
+TEST_CASE( "parse string array in chunks", "[JsonStringArrayParser]" )
+{
+  std::string json(" [\"prefix/a\", \"prefix/b\\\"\\u00e9\\ud83d\\ude00\" ,\n\"\"] ");
+  for(std::size_t chunk = 1; chunk <= json.size(); chunk++)
+  {
+    std::vector<std::string> values;
+    JsonStringArrayParser parser([&values](const std::string & value) {
+        values.push_back(value);
+        return true;
+      });
+    for(std::size_t pos = 0; pos < json.size(); pos += chunk)
+    {
+      REQUIRE(parser.feed(json.c_str() + pos, std::min(chunk, json.size() - pos)));
+    }
+    REQUIRE(parser.finish());
+    REQUIRE(values == std::vector<std::string>({"prefix/a", "prefix/b\"\xc3\xa9\xf0\x9f\x98\x80", ""}));
+  }
+}
+
+TEST_CASE( "string array parser stops and rejects malformed documents", "[JsonStringArrayParser]" )
+{
+  std::size_t n = 0;
+  JsonStringArrayParser stop([&n](const std::string & value) {
+      return ++n < 2;
+    });
+  std::string json("[\"a\",\"b\",\"c\"]");
+  REQUIRE_FALSE(stop.feed(json.c_str(), json.size()));
+  REQUIRE(n == 2);
+  REQUIRE(stop.getError().empty());
+
+  auto parse = [](const std::string & doc, std::string & error) {
+    JsonStringArrayParser parser([](const std::string & value) { return true; });
+    bool ok = parser.feed(doc.c_str(), doc.size()) && parser.finish();
+    error = parser.getError();
+    return ok;
+  };
+  std::string error;
+  REQUIRE(parse("[]", error));
+  REQUIRE_FALSE(parse("{}", error));
+  REQUIRE(error == "did not return an array");
+  REQUIRE_FALSE(parse("[1]", error));
+  REQUIRE(error == "element is not a String");
+  REQUIRE_FALSE(parse("[\"a\"", error));
+  REQUIRE(error == "incomplete array");
+  REQUIRE_FALSE(parse("[\"a\" \"b\"]", error));
+  REQUIRE_FALSE(parse("[\"a\",]", error));
+  REQUIRE_FALSE(parse("[\"a\"] x", error));
+  REQUIRE_FALSE(parse("[\"\\x\"]", error));
+}
@@ -0,0 +1,437 @@
+/*
+Copyright 2018, SURFsara
+Author Stefan Wolfsheimer
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <catch2/catch.hpp>
+#include <surfsara/handle_util.h>
+#include <surfsara/irods_handle_client.h>
+#include <surfsara/lru_cache.h>
+#include <surfsara/handle_client.h>
+#include <surfsara/reverse_lookup_client.h>
+#include <surfsara/curl.h>
+#include <surfsara/ast.h>
+#include <surfsara/json_parser.h>
+#include "mock_http_server.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <sstream>
+#include <iostream>
+
+using namespace surfsara::handle;
+using Node = surfsara::ast::Node;
+using Array = surfsara::ast::Array;
+using Object = surfsara::ast::Object;
+using String = surfsara::ast::String;
+
+static const std::size_t numThreads = 8;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Mocks
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* in memory handle server, shared by all threads */
+struct HandleStore
+{
+  std::mutex mutex;
+  std::map<std::string, Node> records;
+  std::size_t counter = 0;
+};
+
+struct ConcurrentHandleClientMock : public I_HandleClient
+{
+  ConcurrentHandleClientMock(std::shared_ptr<HandleStore> _store) : store(_store) {}
+
+  virtual Result create(const std::string & prefix, const Node & node) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    Result res;
+    res.handle = prefix + "/" + std::to_string(store->counter++);
+    store->records[res.handle] = node;
+    res.success = true;
+    return res;
+  }
+
+  virtual Result get(const std::string & handle) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    Result res;
+    auto itr = store->records.find(handle);
+    if(itr != store->records.end())
+    {
+      res.handle = handle;
+      res.data = itr->second;
+      res.success = true;
+    }
+    return res;
+  }
+
+  virtual Result get(const std::string & handle, const std::vector<int> & indices) override
+  {
+    return get(handle);
+  }
+
+  virtual Result get(const std::string & handle, const std::vector<std::string> & types) override
+  {
+    return get(handle);
+  }
+
+  virtual Result update(const std::string & handle, const Node & node) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    Result res;
+    auto itr = store->records.find(handle);
+    if(itr != store->records.end())
+    {
+      mergeValues(itr->second, node);
+      res.handle = handle;
+      res.success = true;
+    }
+    return res;
+  }
+
+  virtual Result removeIndices(const std::string & handle, const std::vector<int> & indices) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    Result res;
+    auto itr = store->records.find(handle);
+    if(itr != store->records.end())
+    {
+      removeValues(itr->second, indices);
+      res.handle = handle;
+      res.success = true;
+    }
+    return res;
+  }
+
+  virtual Result remove(const std::string & handle) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    Result res;
+    res.success = (store->records.erase(handle) > 0);
+    res.handle = handle;
+    return res;
+  }
+
+  std::shared_ptr<HandleStore> store;
+};
+
+/* finds handles by the value of an entry of the given type */
+struct ConcurrentReverseLookupClientMock : public I_ReverseLookupClient
+{
+  ConcurrentReverseLookupClientMock(std::shared_ptr<HandleStore> _store) : store(_store) {}
+
+  virtual std::vector<std::string> lookup(const std::vector<std::pair<std::string, std::string>> & query) override
+  {
+    std::lock_guard<std::mutex> lock(store->mutex);
+    std::vector<std::string> ret;
+    for(auto & rec : store->records)
+    {
+      bool found = false;
+      rec.second.as<Object>()["values"].as<Array>().forEach([&](const Node & entry){
+          const Object & obj(entry.as<Object>());
+          if(obj.has("type") && obj.get("type").as<String>() == query[0].first &&
+             obj.get("data").as<Object>().get("value").as<String>() == query[0].second)
+          {
+            found = true;
+          }
+        });
+      if(found)
+      {
+        ret.push_back(rec.first);
+      }
+    }
+    return ret;
+  }
+
+  std::shared_ptr<HandleStore> store;
+};
+
+static std::string getValue(const Node & node, const std::string & type)
+{
+  std::string ret;
+  node.as<Object>().get("values").as<Array>().forEach([&](const Node & entry){
+      const Object & obj(entry.as<Object>());
+      if(obj.get("type").as<String>() == type)
+      {
+        ret = obj.get("data").as<Object>().get("value").as<String>();
+      }
+    });
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// tests
+//
+////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("shared irods handle client", "[ThreadSafety]")
+{
+  auto store = std::make_shared<HandleStore>();
+  IRodsHandleClient client(std::make_shared<ConcurrentHandleClientMock>(store),
+                           "prefix",
+                           std::make_shared<ConcurrentReverseLookupClientMock>(store),
+                           std::make_shared<HandleProfile>(std::map<std::string, std::string>{
+                               {"IRODS_URL_PREFIX", "irods://myserver:1247"},
+                               {"IRODS_WEBDAV_PREFIX", "webdav://myserver:80"},
+                               {"IRODS_SERVER", "myserver"},
+                               {"HANDLE_PREFIX", "HANDLE"},
+                               {"IRODS_PORT", "1247"}}),
+                           true,
+                           "IRODS/URL",
+                           "{IRODS_URL_PREFIX}{OBJECT}");
+  const std::size_t numObjects = 20;
+  std::atomic<std::size_t> errors(0);
+  std::vector<std::thread> threads;
+  for(std::size_t t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&client, &errors, t, numObjects](){
+          for(std::size_t i = 0; i < numObjects; i++)
+          {
+            std::string path = "/zone/t" + std::to_string(t) + "/obj" + std::to_string(i);
+            std::string newPath = "/zone/t" + std::to_string(t) + "/moved" + std::to_string(i);
+            try
+            {
+              if(!client.create(path, {{"KEY", std::to_string(i)}}).success ||
+                 !client.move(path, newPath).success)
+              {
+                errors++;
+                continue;
+              }
+              auto res = client.get(newPath);
+              if(!res.success ||
+                 getValue(res.data, "IRODS/URL") != "irods://myserver:1247" + newPath ||
+                 getValue(res.data, "KEY") != std::to_string(i) ||
+                 !client.remove(newPath).success)
+              {
+                errors++;
+              }
+            }
+            catch(...)
+            {
+              errors++;
+            }
+          }
+        }));
+  }
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+  REQUIRE(errors == 0);
+  REQUIRE(store->records.empty());
+  REQUIRE(store->counter == numThreads * numObjects);
+}
+
+TEST_CASE("shared lru cache", "[ThreadSafety]")
+{
+  const std::size_t numOps = 20000;
+  surfsara::util::LruCache<int, int> cache(50);
+  std::atomic<std::size_t> gets(0);
+  std::atomic<std::size_t> errors(0);
+  std::vector<std::thread> threads;
+  for(std::size_t t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&, t](){
+          std::mt19937 engine(t);
+          std::uniform_int_distribution<int> key(0, 99);
+          std::uniform_int_distribution<int> op(0, 9);
+          for(std::size_t i = 0; i < numOps; i++)
+          {
+            int k = key(engine);
+            int o = op(engine);
+            int v;
+            if(o < 6)
+            {
+              gets++;
+              if(cache.get(k, v) && v != k)
+              {
+                errors++;
+              }
+            }
+            else if(o < 9)
+            {
+              cache.put(k, k);
+            }
+            else
+            {
+              cache.erase(k);
+            }
+          }
+        }));
+  }
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+  auto stats = cache.getStatistics();
+  REQUIRE(errors == 0);
+  REQUIRE(stats.hits + stats.misses == gets);
+  REQUIRE(stats.entries <= 50);
+  REQUIRE(stats.entries == stats.bytes);
+}
+
+TEST_CASE("shared curl handle pool", "[ThreadSafety]")
+{
+  surfsara::curl::globalInit();
+  auto & pool = surfsara::curl::HandlePool::instance();
+  std::atomic<std::size_t> errors(0);
+  std::vector<std::thread> threads;
+  for(std::size_t t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&](){
+          for(std::size_t i = 0; i < 1000; i++)
+          {
+            CURL * curl = pool.acquire();
+            if(!curl)
+            {
+              errors++;
+              continue;
+            }
+            pool.release(curl);
+          }
+        }));
+  }
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+  REQUIRE(errors == 0);
+  REQUIRE(pool.idleSize() <= numThreads);
+  REQUIRE(pool.idleSize() > 0);
+}
+
+TEST_CASE("shared handle and reverse lookup client over http", "[ThreadSafety]")
+{
+  const std::size_t numIterations = 50;
+  // value of the KEY entry by handle, only accessed by the handler
+  std::map<std::string, std::string> values{{"prefix/shared", "shared"}};
+  auto record = [](const std::string & handle, const std::string & value) {
+    return (std::string("{\"responseCode\":1,\"handle\":\"") + handle + "\",\"values\":["
+            "{\"index\":1,\"type\":\"KEY\",\"data\":{\"format\":\"string\",\"value\":\"" + value + "\"}}]}");
+  };
+  MockHttpServer server([&values, &record](const HttpRequest & request) {
+      const std::string api("/api/handles/");
+      if(request.path.compare(0, api.size(), api) == 0)
+      {
+        std::string handle(request.path.substr(api.size()));
+        if(request.method == "PUT")
+        {
+          values[handle] = extractValueByType(surfsara::ast::parseJson(request.body), "KEY");
+          return HttpResponse(200, std::string("{\"responseCode\":1,\"handle\":\"") + handle + "\"}");
+        }
+        auto itr = values.find(handle);
+        if(request.method == "GET" && itr != values.end())
+        {
+          return HttpResponse(200, record(handle, itr->second));
+        }
+        return HttpResponse(404, std::string("{\"responseCode\":100,\"handle\":\"") + handle + "\"}");
+      }
+      else if(request.path == "/hrls/handles/prefix")
+      {
+        std::string ret;
+        for(auto & p : request.query)
+        {
+          for(auto & v : values)
+          {
+            if(p.first == "KEY" && v.second == p.second)
+            {
+              ret += (ret.empty() ? "\"" : ",\"") + v.first + "\"";
+            }
+          }
+        }
+        return HttpResponse(200, "[" + ret + "]");
+      }
+      return HttpResponse(400, "{}");
+    });
+  HandleClient client(server.getUrl() + "/api/handles",
+                      {},
+                      true,
+                      std::make_shared<RecordCache>(100, 0, std::chrono::seconds(60), &HandleClient::recordSize));
+  ReverseLookupClient reverseLookup(server.getUrl() + "/hrls/handles", "prefix", {}, 100, 0, true);
+
+  // verbose output of all threads, each block is written under the output mutex
+  std::stringstream output;
+  auto coutBuf = std::cout.rdbuf(output.rdbuf());
+  std::atomic<std::size_t> errors(0);
+  std::vector<std::thread> threads;
+  for(std::size_t t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&, t](){
+          std::string handle = "prefix/t" + std::to_string(t);
+          for(std::size_t i = 0; i < numIterations; i++)
+          {
+            try
+            {
+              std::string value = std::to_string(t) + "-" + std::to_string(i);
+              auto node = surfsara::ast::parseJson(std::string("{\"values\":[{\"index\":1,\"type\":\"KEY\","
+                                                               "\"data\":{\"format\":\"string\",\"value\":\"") + value + "\"}}]}");
+              if(!client.update(handle, node).success)
+              {
+                errors++;
+              }
+              // served from the cache after the first GET, modified by write-through
+              auto res = client.get(handle);
+              if(!res.success || extractValueByType(res.data, "KEY") != value)
+              {
+                errors++;
+              }
+              res = client.get("prefix/shared");
+              if(!res.success || extractValueByType(res.data, "KEY") != "shared")
+              {
+                errors++;
+              }
+              if(reverseLookup.lookup({{"KEY", "shared"}}) != std::vector<std::string>({"prefix/shared"}))
+              {
+                errors++;
+              }
+            }
+            catch(...)
+            {
+              errors++;
+            }
+          }
+        }));
+  }
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+  std::cout.rdbuf(coutBuf);
+  REQUIRE(errors == 0);
+  for(std::size_t t = 0; t < numThreads; t++)
+  {
+    REQUIRE(values["prefix/t" + std::to_string(t)] == std::to_string(t) + "-" + std::to_string(numIterations - 1));
+  }
+  std::size_t blocks = 0;
+  std::string line;
+  while(std::getline(output, line))
+  {
+    if(line == "request data:")
+    {
+      blocks++;
+    }
+  }
+  REQUIRE(blocks == numThreads * numIterations);
+  REQUIRE(client.getCacheStatistics().hits >= numThreads * (2 * numIterations - 2));
+  REQUIRE(reverseLookup.getStatistics().requests == numThreads * numIterations);
+  // pooled easy handles keep their connection
+  REQUIRE(server.getConnections() * 4 < server.getRequests());
+}
@@ -17,7 +17,16 @@ limitations under the License.
 */
 #include <catch2/catch.hpp>
 #include <surfsara/util.h>
+#include <surfsara/lru_cache.h>
+#include <surfsara/page_prefetcher.h>
+#include <surfsara/bloom_filter.h>
+#include <surfsara/path_index.h>
+#include <surfsara/parallel.h>
 #include <surfsara/ast.h>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
 
 using namespace surfsara::util;
 
@@ -69,3 +78,362 @@ TEST_CASE( "replace", "[util]" )
   }
 }
 
+TEST_CASE( "globMatch", "[util]" )
+{
+  REQUIRE(globMatch("abc", "abc"));
+  REQUIRE_FALSE(globMatch("abc", "abcd"));
+  REQUIRE(globMatch("*", ""));
+  REQUIRE(globMatch("*", "abc"));
+  REQUIRE(globMatch("irods://*/zone/*.txt", "irods://server/zone/a/b.txt"));
+  REQUIRE_FALSE(globMatch("irods://*/zone/*.txt", "irods://server/zone/a/b.csv"));
+  REQUIRE(globMatch("*a*b", "xaxxab"));
+  REQUIRE_FALSE(globMatch("*a*b", "xaxxba"));
+
+  // escaped wildcards match themselves only
+  REQUIRE(escapeGlob("/a*b?[c]\\d") == "/a\\*b\\?\\[c]\\\\d");
+  REQUIRE(globMatch(escapeGlob("/zone/a*b") + "/*", "/zone/a*b/c.txt"));
+  REQUIRE_FALSE(globMatch(escapeGlob("/zone/a*b") + "/*", "/zone/axxb/c.txt"));
+  REQUIRE(globMatch(escapeGlob("/zone/a\\b") + "/*", "/zone/a\\b/c.txt"));
+}
+
+TEST_CASE( "lru cache evicts least recently used entry", "[LruCache]" )
+{
+  LruCache<std::string, int> cache(2);
+  int value = 0;
+  cache.put("a", 1);
+  cache.put("b", 2);
+  REQUIRE(cache.get("a", value));
+  REQUIRE(value == 1);
+  cache.put("c", 3);
+  REQUIRE_FALSE(cache.get("b", value));
+  REQUIRE(cache.get("a", value));
+  REQUIRE(cache.get("c", value));
+  REQUIRE(value == 3);
+  auto stats = cache.getStatistics();
+  REQUIRE(stats.hits == 3);
+  REQUIRE(stats.misses == 1);
+  REQUIRE(stats.evictions == 1);
+  REQUIRE(stats.entries == 2);
+}
+
+TEST_CASE( "lru cache is bounded by bytes", "[LruCache]" )
+{
+  LruCache<std::string, std::string> cache(0, 10, std::chrono::milliseconds(0),
+                                           [](const std::string & k, const std::string & v) {
+                                             return v.size();
+                                           });
+  std::string value;
+  cache.put("a", "1234");
+  cache.put("b", "1234");
+  cache.put("c", "1234");
+  REQUIRE_FALSE(cache.get("a", value));
+  REQUIRE(cache.get("b", value));
+  REQUIRE(cache.get("c", value));
+  REQUIRE(cache.getStatistics().bytes == 8);
+  cache.put("d", "12345678901");
+  REQUIRE_FALSE(cache.get("d", value));
+  REQUIRE(cache.modify("b", [](std::string & v) { v = "12345678"; }));
+  REQUIRE(cache.get("b", value));
+  REQUIRE(value == "12345678");
+  REQUIRE_FALSE(cache.get("c", value));
+  REQUIRE(cache.getStatistics().bytes == 8);
+}
+
+TEST_CASE( "lru cache entries expire", "[LruCache]" )
+{
+  LruCache<std::string, int> cache(10, 0, std::chrono::milliseconds(1));
+  int value = 0;
+  cache.put("a", 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE_FALSE(cache.get("a", value));
+  REQUIRE(cache.getStatistics().entries == 0);
+  cache.put("a", 1);
+  REQUIRE(cache.erase("a"));
+  REQUIRE_FALSE(cache.erase("a"));
+}
+
+TEST_CASE( "lru cache keeps expired entries for revalidation", "[LruCache]" )
+{
+  LruCache<std::string, int> cache(10, 0, std::chrono::milliseconds(1));
+  int value = 0;
+  bool expired = false;
+  cache.put("a", 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(cache.get("a", value, expired));
+  REQUIRE(expired);
+  REQUIRE(value == 1);
+  REQUIRE(cache.getStatistics().misses == 1);
+  REQUIRE(cache.refresh("a"));
+  auto stats = cache.getStatistics();
+  REQUIRE(stats.hits == 1);
+  REQUIRE(stats.misses == 0);
+  REQUIRE(stats.revalidations == 1);
+  REQUIRE_FALSE(cache.refresh("b"));
+}
+
+TEST_CASE( "prefetched pages are delivered in order", "[PagePrefetcher]" )
+{
+  std::atomic<int> running(0);
+  std::atomic<int> maxRunning(0);
+  auto fetch = [&running, &maxRunning](std::size_t page) {
+    int r = ++running;
+    int m = maxRunning;
+    while(r > m && !maxRunning.compare_exchange_weak(m, r)) {}
+    // later pages answer faster
+    std::this_thread::sleep_for(std::chrono::milliseconds(page < 5 ? 5 - page : 1));
+    std::vector<std::string> ret;
+    for(std::size_t i = page * 10; i < 95 && i < page * 10 + 10; i++)
+    {
+      ret.push_back(std::to_string(i));
+    }
+    running--;
+    return ret;
+  };
+  surfsara::util::PagePrefetcher prefetcher(fetch, 10, 4);
+  std::vector<std::string> items;
+  REQUIRE(prefetcher.forEach(0, [&items](const std::string & item) {
+        items.push_back(item);
+        return true;
+      }) == 95);
+  for(std::size_t i = 0; i < items.size(); i++)
+  {
+    REQUIRE(items[i] == std::to_string(i));
+  }
+  REQUIRE(maxRunning <= 4);
+  REQUIRE(prefetcher.getWindow() >= 1);
+  REQUIRE(prefetcher.getWindow() <= 4);
+
+  items.clear();
+  REQUIRE(prefetcher.forEach(2, [&items](const std::string & item) {
+        items.push_back(item);
+        return items.size() < 15;
+      }) == 15);
+  REQUIRE(items.front() == "20");
+  REQUIRE(items.back() == "34");
+}
+
+TEST_CASE( "prefetcher stops if the server ignores the page", "[PagePrefetcher]" )
+{
+  surfsara::util::PagePrefetcher prefetcher([](std::size_t page) {
+      return std::vector<std::string>({"a", "b"});
+    }, 2, 3);
+  std::size_t n = prefetcher.forEach(0, [](const std::string & item) { return true; });
+  REQUIRE(n == 2);
+}
+
+TEST_CASE( "prefetcher stops requesting pages after a short page", "[PagePrefetcher]" )
+{
+  std::atomic<std::size_t> requests(0);
+  std::atomic<std::size_t> maxPage(0);
+  surfsara::util::PagePrefetcher prefetcher([&requests, &maxPage](std::size_t page) {
+      requests++;
+      std::size_t m = maxPage;
+      while(page > m && !maxPage.compare_exchange_weak(m, page)) {}
+      // the short page 2 arrives long before the consumer reaches it
+      if(page < 2)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+      std::vector<std::string> ret;
+      for(std::size_t i = page * 10; i < 25 && i < page * 10 + 10; i++)
+      {
+        ret.push_back(std::to_string(i));
+      }
+      return ret;
+    }, 10, 8, 8);
+  std::size_t n = prefetcher.forEach(0, [](const std::string & item) { return true; });
+  REQUIRE(n == 25);
+  // only the initial window has been requested
+  REQUIRE(maxPage <= 7);
+  REQUIRE(requests <= 8);
+}
+
+TEST_CASE( "bloom filter has no false negatives", "[BloomFilter]" )
+{
+  BloomFilter filter(1000, 10);
+  REQUIRE(filter.getHashes() == 7);
+  for(int i = 0; i < 1000; i++)
+  {
+    filter.add(std::string("/zone/home/obj") + std::to_string(i));
+  }
+  // no negative answers before the filter is complete
+  REQUIRE_FALSE(filter.isComplete());
+  REQUIRE(filter.mayContain("/zone/home/other"));
+  filter.setComplete();
+  REQUIRE(filter.getCount() == 1000);
+  for(int i = 0; i < 1000; i++)
+  {
+    REQUIRE(filter.mayContain(std::string("/zone/home/obj") + std::to_string(i)));
+  }
+  int falsePositives = 0;
+  for(int i = 1000; i < 11000; i++)
+  {
+    if(filter.mayContain(std::string("/zone/home/obj") + std::to_string(i)))
+    {
+      falsePositives++;
+    }
+  }
+  // about 1%
+  REQUIRE(falsePositives < 300);
+}
+
+TEST_CASE( "bloom filter is persisted in file", "[BloomFilter]" )
+{
+  char name[] = "/tmp/test_bloom_XXXXXX";
+  int fd = mkstemp(name);
+  REQUIRE(fd >= 0);
+  close(fd);
+  {
+    BloomFilter filter(100, 16, name);
+    filter.add("abc");
+    REQUIRE(filter.mayContain("def"));
+    filter.setComplete();
+    filter.sync();
+  }
+  {
+    // size of the existing file takes precedence
+    BloomFilter filter(1, 1, name);
+    REQUIRE(filter.getBits() == 1600);
+    REQUIRE(filter.getCount() == 1);
+    REQUIRE(filter.isComplete());
+    REQUIRE(filter.mayContain("abc"));
+    REQUIRE_FALSE(filter.mayContain("def"));
+  }
+  std::remove(name);
+}
+
+TEST_CASE( "path index maps keys to values", "[PathIndex]" )
+{
+  char name[] = "/tmp/test_path_index_XXXXXX";
+  int fd = mkstemp(name);
+  REQUIRE(fd >= 0);
+  close(fd);
+  {
+    PathIndex index(name, 16);
+    std::string value;
+    REQUIRE_FALSE(index.get("/zone/a", value));
+    REQUIRE(index.put("/zone/a", "prefix/a"));
+    REQUIRE(index.put("/zone/b", "prefix/b"));
+    REQUIRE(index.put("/zone/a", "prefix/c"));
+    REQUIRE(index.size() == 2);
+    REQUIRE(index.get("/zone/a", value));
+    REQUIRE(value == "prefix/c");
+    REQUIRE_FALSE(index.put("/zone/long", std::string(PathIndex::maxValueSize + 1, 'x')));
+  }
+  {
+    // reopened by another process
+    PathIndex index(name, 1000);
+    REQUIRE(index.capacity() == 16);
+    std::string value;
+    REQUIRE(index.get("/zone/b", value));
+    REQUIRE(value == "prefix/b");
+    REQUIRE(index.erase("/zone/b"));
+    REQUIRE_FALSE(index.get("/zone/b", value));
+    REQUIRE(index.erase("/zone/a"));
+    REQUIRE(index.size() == 0);
+
+    // tombstones are reclaimed, a quarter of the slots stays free
+    for(int round = 0; round < 3; round++)
+    {
+      for(int i = 0; i < 12; i++)
+      {
+        REQUIRE(index.put(std::to_string(i), std::to_string(i)));
+      }
+      REQUIRE_FALSE(index.put("13", "13"));
+      for(int i = 0; i < 12; i++)
+      {
+        REQUIRE(index.get(std::to_string(i), value));
+        REQUIRE(value == std::to_string(i));
+        REQUIRE(index.erase(std::to_string(i)));
+      }
+    }
+  }
+  std::remove(name);
+}
+
+TEST_CASE( "path index readers run concurrently with a writer", "[PathIndex]" )
+{
+  char name[] = "/tmp/test_path_index_XXXXXX";
+  int fd = mkstemp(name);
+  REQUIRE(fd >= 0);
+  close(fd);
+  PathIndex index(name, 1024);
+  std::atomic<bool> done(false);
+  std::atomic<int> mismatches(0);
+  std::thread writer([&index, &done]() {
+      for(int i = 0; i < 20000; i++)
+      {
+        std::string key = std::to_string(i % 500);
+        index.put(key, std::string("prefix/") + key);
+        if(i % 3 == 0)
+        {
+          index.erase(key);
+        }
+      }
+      done = true;
+    });
+  std::vector<std::thread> readers;
+  for(int t = 0; t < 4; t++)
+  {
+    readers.push_back(std::thread([&index, &done, &mismatches]() {
+          int i = 0;
+          while(!done)
+          {
+            std::string key = std::to_string(i++ % 500);
+            std::string value;
+            if(index.get(key, value) && value != std::string("prefix/") + key)
+            {
+              mismatches++;
+            }
+          }
+        }));
+  }
+  writer.join();
+  for(auto & t : readers)
+  {
+    t.join();
+  }
+  REQUIRE(mismatches == 0);
+  std::remove(name);
+}
+
+TEST_CASE( "parallel for calls each index once", "[parallelFor]" )
+{
+  std::vector<std::atomic<int>> calls(100);
+  for(auto & c : calls)
+  {
+    c = 0;
+  }
+  parallelFor(calls.size(), 8, [&calls](std::size_t i) {
+      calls[i]++;
+    });
+  for(auto & c : calls)
+  {
+    REQUIRE(c == 1);
+  }
+  REQUIRE_THROWS_AS(parallelFor(100, 4, [](std::size_t i) {
+        if(i == 10)
+        {
+          throw std::runtime_error("failed");
+        }
+      }), std::runtime_error);
+}
+
+TEST_CASE( "rate limiter spaces calls of several threads", "[RateLimiter]" )
+{
+  RateLimiter unlimited(0);
+  auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < 1000; i++)
+  {
+    unlimited.acquire();
+  }
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100));
+
+  // 1 call at once, 10 more at 200 per second
+  RateLimiter limiter(200);
+  start = std::chrono::steady_clock::now();
+  parallelFor(11, 4, [&limiter](std::size_t i) {
+      limiter.acquire();
+    });
+  REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(45));
+}